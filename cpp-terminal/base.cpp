@@ -1,11 +1,13 @@
 #include "base.hpp"
 #include "platform.hpp"
 #include "window.hpp"
-#include "unicodelib_encodings.h"
+#include "renderer.hpp"
+#include "queries.hpp"
 
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <future>
 
 
 
@@ -89,51 +91,26 @@ void Term::save_screen() {
 }
 
 void Term::get_cursor_position(size_t& cols, size_t& rows) {
-    string buf;
-    char32_t c;
-    write("\x1b[6n"); // cursor position report
-    for (unsigned int i = 0; i < 64; i++) {
-        while (!Private::read_raw(&c))
-            ;
-        buf.push_back(char(c));
-        if (c == U'R') {
-            if (i < 5) {
-                throw runtime_error(
-                    "get_cursor_position(): too short response");
-            }
-            break;
-        }
-    }
-    // Expected response: <ESC>[{ROW};{COLUMN}R
-    // Find the result in the response, drop the rest:
-    size_t i = buf.find("\x1b[");
-    bool ok = (i != string::npos);
-    if (ok) {
-        i = buf.find_first_of("0123456789", i + 2);
-        ok = (i != string::npos);   
-    }
-    if (ok) {
-        buf = buf.substr(i);
-        rows = stoul(buf, &i) - 1;
-        ok = (i < buf.size());
-    }
-    if (ok) {
-        buf = buf.substr(i + 1);  // skip ';'
-        cols = stoul(buf, &i) - 1;
-    } else {
-        throw runtime_error(
-            "get_cursor_position(): result could not be parsed");
-    }
-    return;
+    QueryParser parser;
+    string request;
+    future<string> response =
+        parser.add(QueryParser::CURSOR_POSITION, request);
+    write(request);
+    Private::await_responses(parser);
+    // throws if the terminal has not answered
+    parse_cursor_position(response.get(), cols, rows);
 }
 
 Term::Terminal::Terminal(unsigned options)
     : BaseTerminal(
         bool(options & CLEAR_SCREEN),
         bool(options & RAW_INPUT),
-        bool(options & DISABLE_CTRL_C))
+        bool(options & DISABLE_CTRL_C),
+        !(options & DISABLE_PROBING))
     , w(0)
     , h(0)
+    , colors(capabilities.colors)
+    , encoder(&Private::get_encoder(capabilities, colors))
 {
     update_size();
 }
@@ -158,98 +135,36 @@ size_t Term::Terminal::get_h() const {
     return h;
 }
 
+const Term::Capabilities& Term::Terminal::get_capabilities() const {
+    return capabilities;
+}
+
+void Term::Terminal::set_colors(unsigned c) {
+    colors = c;
+    encoder = &Private::get_encoder(capabilities, colors);
+}
+
+unsigned Term::Terminal::get_colors() const {
+    return colors;
+}
+
+const Term::Private::Encoder& Term::Terminal::get_encoder() const {
+    return *encoder;
+}
+
 void Term::Terminal::draw_window (const Window& win,
                                   size_t x0, 
                                   size_t y0,
                                   size_t width, 
                                   size_t height) {
     update_size();
-    if (!width) width = w;
-    if (!height) height = h;
-    // inside win?
-    if (x0 >= win.get_w() || y0 >= win.get_h()) return;
-    // adjust the cut-out to fit both win and console window
-    width = std::min({width, w, win.get_w() - x0});
-    height = std::min({height, h, win.get_h() - y0});
-    string out = Term::cursor_off() + Term::clear_screen_buffer() +
-                 Term::move_cursor(0, 0);
-    Window merged_win = win.merge_children();
-    FgColor current_fg(fg::reset);
-    BgColor current_bg(bg::reset);
-    style current_style = style::reset;
-    const size_t x1 = x0 + width;
-    const size_t y1 = y0 + height;
-    for (size_t j = y0; j < y1; j++) {
-        if (j > y0) {
-            // Resetting background color at the end of each line
-            // is a workaround for the bug in Visual Studio Code
-            // (https://github.com/jupyter-xeus/cpp-terminal/issues/95)
-            if (!current_bg.is_reset()) {
-                out.append(color(bg::reset));
-                current_bg = bg::reset;
-            }
-            out.append("\n");
-        }
-        size_t i = x0;
-        for (; i < x1; i++) {
-            bool update_fg = false;
-            bool update_bg = false;
-            bool update_style = false;
-            Cell cell = merged_win.get_cell(i, j);
-            if (!cell.grapheme_length || cell.ch[0] == U'\0') {
-                cell.grapheme_length = 1;
-                cell.ch[0] = U' ';
-            }
-            if (cell.cell_fg.is_unspecified()) {
-                cell.cell_fg = win.get_default_fg();
-            }
-            if (cell.cell_bg.is_unspecified()) {
-                cell.cell_bg = win.get_default_bg();
-            }
-            if (cell.cell_style == style::unspecified) {
-                cell.cell_style = win.get_default_style();
-            }
-            if (current_fg != cell.cell_fg) {
-                current_fg = cell.cell_fg;
-                update_fg = true;
-            }
-            if (current_bg != cell.cell_bg) {
-                current_bg = cell.cell_bg;
-                update_bg = true;
-            }
-            if (current_style != cell.cell_style) {
-                current_style = cell.cell_style;
-                update_style = true;
-                if (current_style == style::reset) {
-                    // style::reset resets fg and bg colors too, we have to
-                    // set them again if they are non-default, but if fg or
-                    // bg colors are reset, we do not update them, as
-                    // style::reset already did that.
-                    update_fg = !current_fg.is_reset();
-                    update_bg = !current_bg.is_reset();
-                }
-            }
-            // Set style first, as style::reset will reset colors too
-            if (update_style) out.append(color(cell.cell_style));
-            if (update_fg) out.append(cell.cell_fg.render());
-            if (update_bg) out.append(cell.cell_bg.render());
-            unicode::utf8::encode(cell.ch, cell.grapheme_length, out);
-        }
-    }
-    // reset colors and style at the end
-    if (!current_fg.is_reset()) out.append(color(fg::reset));
-    if (!current_bg.is_reset()) out.append(color(bg::reset));
-    if (current_style != style::reset) out.append(color(style::reset));
-    cout << out << flush;
-    // place cursor
-    Cursor cur = merged_win.get_cursor();
-    if (!cur.is_visible) return;
-    if (cur.x < x0) return;
-    cur.x -= x0;
-    if (cur.x >= w || cur.x >= win.get_w()) return;
-    if (cur.y < y0) return;
-    cur.y -= y0;  
-    if (cur.y >= h || cur.y >= win.get_h()) return;
-    cout << Term::move_cursor(cur.x, cur.y);
-    cout << cursor_on() << flush;
+    cout << render_window(win, x0, y0, width, height) << flush;
+}
+
+string Term::Terminal::render_window(const Window& win,
+                                     size_t x0,
+                                     size_t y0,
+                                     size_t width,
+                                     size_t height) const {
+    return encoder->render_window(win, w, h, x0, y0, width, height, "\n");
 }
@@ -11,7 +11,9 @@ enum {
     // Option flags for Terminal constructor
     CLEAR_SCREEN = 1,
     RAW_INPUT = 2,
-    DISABLE_CTRL_C = 4
+    DISABLE_CTRL_C = 4,
+    // RAW_INPUT probes the terminal's capabilities unless this is set
+    DISABLE_PROBING = 8
 };
 
 enum class style : unsigned char {
@@ -115,10 +117,17 @@ void get_cursor_position(size_t&, size_t&);
 
 class Window;
 
+namespace Private {
+struct Encoder;
+}
+
 // initializes the terminal
 class Terminal : public Private::BaseTerminal {
    private:
     size_t w{}, h{};
+    unsigned colors;
+    // the renderers for the capabilities and colors
+    const Private::Encoder* encoder;
 
    public:
     // providing no parameters will disable the keyboard and ctrl+c
@@ -133,11 +142,27 @@ class Terminal : public Private::BaseTerminal {
     size_t get_w() const;
     size_t get_h() const;
 
+    // as detected by the constructor, see detect_capabilities()
+    const Capabilities& get_capabilities() const;
+    // The colors the output is for: 16, 256 or 1 << 24 (truecolor), by
+    // default as detected. With fewer than 1 << 24, RGB colors are mapped
+    // to the nearest entry of the palette, see rgb_to_256().
+    void set_colors(unsigned);
+    unsigned get_colors() const;
+    // the renderers selected for the terminal, see Private::RenderPolicy
+    const Private::Encoder& get_encoder() const;
+
     void draw_window (const Window&, 
                       size_t x0 = 0, 
                       size_t y0 = 0, 
                       size_t width = std::string::npos, 
                       size_t height = std::string::npos);
+    // the output of draw_window(), for the current size of the terminal
+    std::string render_window(const Window&,
+                              size_t x0 = 0,
+                              size_t y0 = 0,
+                              size_t width = std::string::npos,
+                              size_t height = std::string::npos) const;
 };
 
 }  // namespace Term
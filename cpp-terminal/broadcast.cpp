@@ -0,0 +1,113 @@
+#include "broadcast.hpp"
+#include "renderer.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+/*********************
+ * Term::Broadcaster
+ *********************
+ */
+
+Term::Broadcaster::Broadcaster(size_t w_, size_t h_)
+    : w(w_)
+    , h(h_)
+{}
+
+void Term::Broadcaster::add(Session& s) {
+    viewers.push_back(Viewer{&s, false, nullptr});
+}
+
+void Term::Broadcaster::remove(Session& s) {
+    viewers.erase(remove_if(viewers.begin(), viewers.end(),
+                            [&](const Viewer& v) { return v.session == &s; }),
+                  viewers.end());
+}
+
+size_t Term::Broadcaster::get_viewer_count() const {
+    return viewers.size();
+}
+
+void Term::Broadcaster::publish(const Window& win, size_t x0, size_t y0) {
+    if (x0 >= win.get_w() || y0 >= win.get_h()) return;
+    const size_t width = min(w, win.get_w() - x0);
+    const size_t height = min(h, win.get_h() - y0);
+    unique_ptr<Window> frame(
+        new Window(win.merge_children(x0, y0, width, height)));
+    const Cell defaults(U' ', win.get_default_fg(), win.get_default_bg(),
+                        win.get_default_style());
+    const bool delta_ok = shown && shown->get_w() == width &&
+                          shown->get_h() == height &&
+                          shown_defaults == defaults;
+    // The difference is encoded once per encoder for the viewers in sync,
+    // the keyframe only if a viewer needs it
+    for (Stream& stream : streams) {
+        stream.delta_done = false;
+        stream.keyframe_done = false;
+    }
+    auto get_stream = [&](const Private::Encoder* encoder) -> Stream& {
+        for (Stream& stream : streams) {
+            if (stream.encoder == encoder) return stream;
+        }
+        streams.push_back(Stream{encoder, string(), string(), false, false});
+        return streams.back();
+    };
+    size_t i = 0;
+    while (i != viewers.size()) {
+        Viewer& v = viewers[i];
+        try {
+            v.session->flush();
+            const Private::Encoder* encoder = &v.session->get_encoder();
+            if (v.session->is_pending()) {
+                // still busy with an earlier frame: this one is skipped,
+                // and the next one has to be drawn completely
+                v.in_sync = false;
+            } else if (v.in_sync && delta_ok && v.encoder == encoder) {
+                Stream& stream = get_stream(encoder);
+                if (!stream.delta_done) {
+                    stream.delta.clear();
+                    encoder->render_diff(*frame, shown.get(), defaults,
+                                         width, height, stream.delta);
+                    encoded += stream.delta.size();
+                    stream.delta_done = true;
+                }
+                v.session->write(stream.delta);
+            } else {
+                Stream& stream = get_stream(encoder);
+                if (!stream.keyframe_done) {
+                    // render_diff() draws every cell, within the
+                    // synchronized update: clearing before it would flash
+                    stream.keyframe.clear();
+                    encoder->render_diff(*frame, nullptr, defaults, width,
+                                         height, stream.keyframe);
+                    encoded += stream.keyframe.size();
+                    ++keyframes;
+                    stream.keyframe_done = true;
+                }
+                v.session->write(stream.keyframe);
+                v.in_sync = true;
+                v.encoder = encoder;
+            }
+            ++i;
+        } catch (const runtime_error&) {
+            // the peer has gone
+            viewers.erase(viewers.begin() + static_cast<ptrdiff_t>(i));
+        }
+    }
+    shown = move(frame);
+    shown_defaults = defaults;
+    ++frames;
+}
+
+size_t Term::Broadcaster::get_frame_count() const {
+    return frames;
+}
+
+size_t Term::Broadcaster::get_keyframe_count() const {
+    return keyframes;
+}
+
+size_t Term::Broadcaster::get_encoded_bytes() const {
+    return encoded;
+}
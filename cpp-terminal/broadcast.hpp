@@ -0,0 +1,72 @@
+#pragma once
+
+#include "session.hpp"
+#include "window.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Term {
+
+/* Shows the same window on many sessions, e.g. a status wall watched by
+ * any number of viewers. publish() composes the frame and encodes its
+ * difference to the frame before once, and writes the same bytes to every
+ * viewer. A viewer which joins later, or which has fallen behind, gets a
+ * keyframe drawing everything instead; it is encoded at most once per
+ * frame as well. So encoding costs do not depend on the number of viewers,
+ * only writing does. Viewers with different color depths (see
+ * Session::set_colors()) get different streams, each encoded once.
+ * A viewer whose output is still pending skips frames until it has caught
+ * up, then gets a keyframe. A viewer whose output fails, e.g. because the
+ * peer has gone, is removed. The viewers' terminals are expected to be at
+ * least as large as the frames.
+ */
+class Broadcaster {
+   protected :
+    struct Viewer {
+        Session* session;
+        bool in_sync;        // has got the previous frame completely
+        // what the frames so far have been encoded with
+        const Private::Encoder* encoder;
+    };
+    // a frame encoded for the viewers with the same encoder
+    struct Stream {
+        const Private::Encoder* encoder;
+        std::string delta;
+        std::string keyframe;
+        bool delta_done;
+        bool keyframe_done;
+    };
+
+    size_t w, h;              // the size of the frames
+    std::vector<Viewer> viewers;
+    std::unique_ptr<Window> shown; // the previous frame
+    Cell shown_defaults;
+    std::vector<Stream> streams; // reused for each frame
+    size_t frames{};
+    size_t keyframes{};
+    size_t encoded{};
+
+   public :
+    // frames of w x h cells, clipped to the windows published
+    Broadcaster(size_t w, size_t h);
+    Broadcaster(const Broadcaster&) = delete;
+    Broadcaster& operator=(const Broadcaster&) = delete;
+
+    // The session gets a keyframe with the next frame. It must outlive
+    // the broadcaster or be removed.
+    void add(Session&);
+    void remove(Session&);
+    size_t get_viewer_count() const;
+
+    // shows the cut-out of the window with the top left corner (x0, y0)
+    // on all viewers
+    void publish(const Window&, size_t x0 = 0, size_t y0 = 0);
+
+    size_t get_frame_count() const;    // frames published
+    size_t get_keyframe_count() const; // keyframes encoded
+    size_t get_encoded_bytes() const;  // bytes encoded, all frames
+};
+
+}  // namespace Term
@@ -0,0 +1,254 @@
+#include "canvas.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+/**********************
+ * Term::CanvasWindow
+ **********************
+ */
+
+Term::CanvasWindow::CanvasWindow(size_t width, size_t height)
+    : Window(width, 0) // no rows needed
+{
+    h = height;
+    height_fixed = (height != 0);
+}
+
+Term::CanvasWindow::Tile* Term::CanvasWindow::find_tile(size_t tx,
+                                                        size_t ty) const {
+    auto it = tiles.find(tile_key(tx, ty));
+    if (it == tiles.end()) return nullptr;
+    return it->second.get();
+}
+
+const vector<Term::Cell>* Term::CanvasWindow::find_row(size_t) const {
+    return nullptr;
+}
+
+vector<Term::Cell>& Term::CanvasWindow::access_row(size_t) {
+    throw logic_error("CanvasWindow::access_row(): canvas has no rows");
+}
+
+const Term::Cell* Term::CanvasWindow::find_cell(size_t x, size_t y) const {
+    if (x >= w || y >= h) return nullptr;
+    const Tile* tile = find_tile(x / TILE_W, y / TILE_H);
+    if (!tile) return nullptr;
+    return &tile->cells[y % TILE_H][x % TILE_W];
+}
+
+Term::Cell& Term::CanvasWindow::access_cell(size_t x, size_t y) {
+    unique_ptr<Tile>& tile = tiles[tile_key(x / TILE_W, y / TILE_H)];
+    if (!tile) {
+        tile.reset(new Tile);
+        if (resolving_defaults) {
+            for (auto& row : tile->cells)
+                fill(row, row + TILE_W, get_blank_cell());
+        }
+    }
+    size_t tx = x % TILE_W;
+    size_t ty = y % TILE_H;
+    if (tx >= tile->used_w) tile->used_w = static_cast<uint8_t>(tx + 1);
+    if (ty >= tile->used_h) tile->used_h = static_cast<uint8_t>(ty + 1);
+    return tile->cells[ty][tx];
+}
+
+void Term::CanvasWindow::store_cells(size_t x, size_t y,
+                                     const Cell* cells, size_t n) {
+    // one tile lookup per tile row touched
+    while (n) {
+        size_t chunk = min(n, TILE_W - x % TILE_W);
+        Cell* dest = &access_cell(x + chunk - 1, y) - (chunk - 1);
+        copy(cells, cells + chunk, dest);
+        if (resolving_defaults) {
+            for (size_t i = 0; i != chunk; ++i) resolve(dest[i]);
+        }
+        x += chunk;
+        cells += chunk;
+        n -= chunk;
+    }
+}
+
+void Term::CanvasWindow::copy_rect(size_t x0, size_t y0,
+                                   size_t width, size_t height,
+                                   vector<SharedRow>& dest) const {
+    dest.assign(height, SharedRow());
+    width = (x0 < w ? min(width, w - x0) : 0);
+    height = (y0 < h ? min(height, h - y0) : 0);
+    if (!width || !height) return;
+    const size_t x1 = x0 + width;
+    const size_t y1 = y0 + height;
+    auto copy_tile = [&](size_t tx, size_t ty, const Tile& tile) {
+        size_t tile_x0 = tx * TILE_W;
+        size_t tile_y0 = ty * TILE_H;
+        size_t from_x = max(x0, tile_x0);
+        size_t to_x = min(x1, tile_x0 + tile.used_w);
+        size_t to_y = min(y1, tile_y0 + tile.used_h);
+        if (from_x >= to_x) return;
+        for (size_t y = max(y0, tile_y0); y < to_y; ++y) {
+            vector<Cell>& row = dest[y - y0].modify();
+            if (row.size() < to_x - x0)
+                row.resize(to_x - x0, get_blank_cell());
+            copy(&tile.cells[y - tile_y0][from_x - tile_x0],
+                 &tile.cells[y - tile_y0][to_x - tile_x0],
+                 row.begin() + (from_x - x0));
+        }
+    };
+    const size_t tx0 = x0 / TILE_W, tx1 = (x1 - 1) / TILE_W;
+    const size_t ty0 = y0 / TILE_H, ty1 = (y1 - 1) / TILE_H;
+    // look up the tiles of the rectangle, unless there are fewer tiles
+    // allocated than the rectangle intersects
+    if ((tx1 - tx0 + 1) * (ty1 - ty0 + 1) <= tiles.size()) {
+        for (size_t ty = ty0; ty <= ty1; ++ty) {
+            for (size_t tx = tx0; tx <= tx1; ++tx) {
+                const Tile* tile = find_tile(tx, ty);
+                if (tile) copy_tile(tx, ty, *tile);
+            }
+        }
+    } else {
+        for (const auto& entry : tiles) {
+            size_t tx = static_cast<size_t>(entry.first & 0xffffffffu);
+            size_t ty = static_cast<size_t>(entry.first >> 32);
+            if (tx >= tx0 && tx <= tx1 && ty >= ty0 && ty <= ty1)
+                copy_tile(tx, ty, *entry.second);
+        }
+    }
+}
+
+void Term::CanvasWindow::resolve_stored_cells() {
+    for (auto& entry : tiles) {
+        for (auto& row : entry.second->cells) {
+            for (Cell& c : row) resolve(c);
+        }
+    }
+}
+
+void Term::CanvasWindow::scroll_rows(size_t n) {
+    n = min(n, h);
+    if (!n) return;
+    // the rows written move to new tiles, the top n rows are dropped
+    auto old_tiles = move(tiles);
+    tiles.clear();
+    for (const auto& entry : old_tiles) {
+        const Tile& tile = *entry.second;
+        if (!tile.used_w) continue;
+        size_t tile_x0 = static_cast<size_t>(entry.first & 0xffffffffu) * TILE_W;
+        size_t tile_y0 = static_cast<size_t>(entry.first >> 32) * TILE_H;
+        for (size_t y = 0; y != tile.used_h; ++y) {
+            if (tile_y0 + y < n) continue;
+            size_t last = tile_x0 + tile.used_w - 1;
+            Cell* dest = &access_cell(last, tile_y0 + y - n) -
+                         (tile.used_w - 1);
+            copy(tile.cells[y], tile.cells[y] + tile.used_w, dest);
+        }
+    }
+}
+
+size_t Term::CanvasWindow::get_tile_count() const {
+    return tiles.size();
+}
+
+void Term::CanvasWindow::crop_tiles() {
+    for (auto it = tiles.begin(); it != tiles.end();) {
+        size_t tile_x0 = static_cast<size_t>(it->first & 0xffffffffu) * TILE_W;
+        size_t tile_y0 = static_cast<size_t>(it->first >> 32) * TILE_H;
+        if (tile_x0 >= w || tile_y0 >= h) {
+            it = tiles.erase(it);
+            continue;
+        }
+        Tile& tile = *it->second;
+        if (tile_x0 + tile.used_w > w) {
+            tile.used_w = static_cast<uint8_t>(w - tile_x0);
+            for (auto& row : tile.cells)
+                fill(row + tile.used_w, row + TILE_W, get_blank_cell());
+        }
+        if (tile_y0 + tile.used_h > h) {
+            tile.used_h = static_cast<uint8_t>(h - tile_y0);
+            for (size_t y = tile.used_h; y != TILE_H; ++y)
+                fill(tile.cells[y], tile.cells[y] + TILE_W,
+                     get_blank_cell());
+        }
+        ++it;
+    }
+}
+
+void Term::CanvasWindow::set_w(size_t new_w) {
+    if (new_w == w) return;
+    bool shrink = (new_w < w);
+    w = new_w;
+    if (w == 0) cursor.x = 0;
+    else if (cursor.x >= w) cursor.x = w - 1;
+    if (shrink) crop_tiles();
+}
+
+void Term::CanvasWindow::set_h(size_t new_h) {
+    // unlike Window::set_h(), there is no grid to resize
+    if (new_h == h) return;
+    bool shrink = (new_h < h);
+    h = new_h;
+    if (h == 0) cursor.y = 0;
+    else if (cursor.y >= h) cursor.y = h - 1;
+    if (shrink) crop_tiles();
+}
+
+void Term::CanvasWindow::trim_w(size_t minimal_width) {
+    size_t x = minimal_width;
+    for (const auto& entry : tiles) {
+        size_t tile_x0 = static_cast<size_t>(entry.first & 0xffffffffu) * TILE_W;
+        if (entry.second->used_w)
+            x = max(x, tile_x0 + entry.second->used_w);
+    }
+    // make sure the cursor remains in the window
+    if (w > minimal_width) x = max(x, cursor.x + 1);
+    set_w(min(x, max(w, minimal_width)));
+}
+
+void Term::CanvasWindow::trim_h(size_t minimal_height) {
+    size_t y = minimal_height;
+    for (const auto& entry : tiles) {
+        size_t tile_y0 = static_cast<size_t>(entry.first >> 32) * TILE_H;
+        if (entry.second->used_h)
+            y = max(y, tile_y0 + entry.second->used_h);
+    }
+    // make sure the cursor remains in the window
+    if (h > minimal_height) y = max(y, cursor.y + 1);
+    set_h(min(y, max(h, minimal_height)));
+}
+
+void Term::CanvasWindow::clear_row(size_t y) {
+    if (y >= h) return;
+    size_t ty = y / TILE_H;
+    for (size_t tx = 0; tx * TILE_W < w; ++tx) {
+        Tile* tile = find_tile(tx, ty);
+        if (tile) {
+            Cell* row = tile->cells[y % TILE_H];
+            fill(row, row + TILE_W, get_blank_cell());
+        }
+    }
+}
+
+void Term::CanvasWindow::clear_grid() {
+    tiles.clear();
+    cursor.x = 0;
+    cursor.y = 0;
+}
+
+void Term::CanvasWindow::set_grid(const vector<SharedRow>& new_grid) {
+    tiles.clear();
+    size_t n = new_grid.size();
+    if (n > h) {
+        if (height_fixed) n = h;
+        else set_h(n);
+    }
+    for (size_t y = 0; y != n; ++y) {
+        const vector<Cell>* row = new_grid[y].get();
+        if (!row || row->empty()) continue;
+        size_t len = row->size();
+        if (len > w) {
+            if (width_fixed) len = w;
+            else set_w(len);
+        }
+        store_cells(0, y, row->data(), len);
+    }
+}
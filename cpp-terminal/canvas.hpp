@@ -0,0 +1,70 @@
+#pragma once
+
+#include "window.hpp"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace Term {
+
+/* A window for huge, sparsely populated canvases (maps, diagrams). The
+ * cells are kept in tiles of TILE_W x TILE_H cells which are allocated on
+ * the first write into them, so memory use depends on the written area
+ * only, not on w x h. Unallocated tiles read as empty cells. Rendering a
+ * cut-out (e.g. by draw_window() with x0, y0) touches only the tiles
+ * intersecting it.
+ */
+class CanvasWindow : public Window {
+   public :
+    enum { TILE_W = 64, TILE_H = 16 };
+
+   protected :
+    struct Tile {
+        Cell cells[TILE_H][TILE_W];
+        // extent of the written cells, for trim_w() and trim_h()
+        uint8_t used_w{};
+        uint8_t used_h{};
+    };
+    std::unordered_map<uint64_t, std::unique_ptr<Tile>> tiles;
+
+    static uint64_t tile_key(size_t tx, size_t ty) {
+        return (static_cast<uint64_t>(ty) << 32) | static_cast<uint64_t>(tx);
+    }
+    Tile* find_tile(size_t tx, size_t ty) const;
+    // resets the cells of all tiles outside of w x h
+    void crop_tiles();
+
+    // there are no rows: all access goes through the cell hooks
+    const std::vector<Cell>* find_row(size_t y) const override;
+    std::vector<Cell>& access_row(size_t y) override;
+    const Cell* find_cell(size_t x, size_t y) const override;
+    Cell& access_cell(size_t x, size_t y) override;
+    void store_cells(size_t x, size_t y, const Cell* cells,
+                     size_t n) override;
+    void copy_rect(size_t x0, size_t y0, size_t width, size_t height,
+                   std::vector<SharedRow>& dest) const override;
+    void resolve_stored_cells() override;
+    // moves the rows of the tiles up
+    void scroll_rows(size_t n) override;
+
+   public :
+    // As with Window, a size of 0 leaves width resp. height unfixed
+    CanvasWindow(size_t width = 0, size_t height = 0);
+    CanvasWindow(const CanvasWindow&) = delete;
+    CanvasWindow& operator=(const CanvasWindow&) = delete;
+
+    size_t get_tile_count() const; // number of allocated tiles
+
+    void set_w(size_t) override;
+    void set_h(size_t) override;
+    void trim_w(size_t minimum_width) override;
+    void trim_h(size_t minimum_height) override;
+    void clear_row(size_t) override;
+    void clear_grid() override;
+    // the rows are copied into tiles
+    using Window::set_grid;
+    void set_grid(const std::vector<SharedRow>&) override;
+};
+
+}  // namespace Term
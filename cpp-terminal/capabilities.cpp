@@ -0,0 +1,246 @@
+#include "capabilities.hpp"
+#include "base.hpp"
+#include "queries.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+string get_env(const char* name) {
+    const char* value = getenv(name);
+    return value ? value : "";
+}
+
+// tabs and line breaks would break the cache file
+string sanitize(string s) {
+    replace_if(s.begin(), s.end(),
+               [](char c) { return c == '\t' || c == '\n' || c == '\r'; },
+               ' ');
+    return s;
+}
+
+// the terminals remembered
+const size_t max_cache_entries = 64;
+// entries older than this are probed again, in case the terminal has been
+// upgraded meanwhile (in seconds)
+const time_t max_cache_age = 7 * 24 * 60 * 60;
+
+// Each line of the cache: key, colors, synchronized_output,
+// kitty_keyboard, version, time written, separated by tabs
+bool read_cache(const string& path, const string& key,
+                Term::Capabilities& c) {
+    ifstream in(path);
+    string line;
+    while (getline(in, line)) {
+        vector<string> fields;
+        size_t start = 0;
+        for (;;) {
+            const size_t tab = line.find('\t', start);
+            fields.push_back(line.substr(start, tab - start));
+            if (tab == string::npos) break;
+            start = tab + 1;
+        }
+        if (fields.size() != 6 || fields[0] != key) continue;
+        try {
+            const time_t written = static_cast<time_t>(stoll(fields[5]));
+            const time_t now = time(nullptr);
+            if (written > now || now - written > max_cache_age) return false;
+            c.colors = static_cast<unsigned>(stoul(fields[1]));
+        } catch (const logic_error&) {
+            return false;
+        }
+        c.synchronized_output = (fields[2] == "1");
+        c.kitty_keyboard = (fields[3] == "1");
+        c.version = fields[4];
+        c.probed = true;
+        return true;
+    }
+    return false;
+}
+
+void write_cache(const string& path, const string& key,
+                 const Term::Capabilities& c) {
+    vector<string> lines;
+    {
+        ifstream in(path);
+        string line;
+        while (getline(in, line)) {
+            if (line.compare(0, key.size() + 1, key + '\t') != 0) {
+                lines.push_back(line);
+            }
+        }
+    }
+    if (lines.size() >= max_cache_entries) {
+        lines.erase(lines.begin(),
+                    lines.end() - (max_cache_entries - 1));
+    }
+    lines.push_back(key + '\t' + to_string(c.colors) + '\t' +
+                    (c.synchronized_output ? "1" : "0") + '\t' +
+                    (c.kitty_keyboard ? "1" : "0") + '\t' +
+                    sanitize(c.version) + '\t' +
+                    to_string(static_cast<long long>(time(nullptr))));
+    // replaced at once, as other processes may read it meanwhile
+    const string temp = path + '.' + to_string(
+        chrono::steady_clock::now().time_since_epoch().count());
+    {
+        ofstream out(temp);
+        for (const string& line : lines) out << line << '\n';
+        if (!out) {
+            out.close();
+            remove(temp.c_str());
+            return;
+        }
+    }
+    if (rename(temp.c_str(), path.c_str()) != 0) remove(temp.c_str());
+}
+
+// Refines c by the responses, returns true if the terminal has answered.
+bool probe(Term::Capabilities& c, int budget_ms) {
+    typedef Term::QueryParser QP;
+    const chrono::milliseconds budget(budget_ms);
+    QP parser;
+    string request;
+    future<string> version = parser.add(QP::VERSION, request, 0, budget);
+    future<string> sync = parser.add(QP::MODE, request, 2026, budget);
+    future<string> keyboard =
+        parser.add(QP::KEYBOARD_FLAGS, request, 0, budget);
+    // a terminal reports the color back as set if it supports truecolor
+    request.append(Term::color24_fg(1, 2, 3));
+    future<string> rendition =
+        parser.add(QP::GRAPHIC_RENDITION, request, 0, budget);
+    request.append(Term::color(Term::style::reset));
+    // answered by every terminal, so the queries before, which are not
+    // supported, fail at once
+    future<string> attributes =
+        parser.add(QP::DEVICE_ATTRIBUTES, request, 0, budget);
+    Term::write(request);
+    Term::Private::await_responses(parser);
+
+    try {
+        c.version = version.get();
+    } catch (const runtime_error&) {
+    }
+    try {
+        const string mode = sync.get();
+        c.synchronized_output = (mode == "1" || mode == "2" || mode == "3");
+    } catch (const runtime_error&) {
+    }
+    try {
+        keyboard.get();
+        c.kitty_keyboard = true;
+    } catch (const runtime_error&) {
+    }
+    try {
+        const string sgr = rendition.get();
+        if (sgr.find("38;2;1;2;3") != string::npos ||
+            sgr.find("38:2::1:2:3") != string::npos ||
+            sgr.find("38:2:1:2:3") != string::npos) {
+            c.colors = 1u << 24;
+        } else {
+            c.colors = min(c.colors, 256u);
+        }
+    } catch (const runtime_error&) {
+    }
+    try {
+        attributes.get();
+    } catch (const runtime_error&) {
+        return false;
+    }
+    c.probed = true;
+    return true;
+}
+
+// sets what follows from the terminal's name
+void derive(Term::Capabilities& c) {
+    const string& v = c.version;
+    auto starts_with = [&](const char* name) {
+        return v.compare(0, char_traits<char>::length(name), name) == 0;
+    };
+    c.repeat = starts_with("XTerm") || starts_with("kitty") ||
+               starts_with("foot") || starts_with("WezTerm");
+    c.reset_bg_at_eol = v.empty() || starts_with("xterm.js") ||
+                        get_env("TERM_PROGRAM") == "vscode";
+}
+
+}  // namespace
+
+Term::Capabilities Term::assume_capabilities() {
+    Capabilities c;
+#ifndef _WIN32
+    // Windows consoles are switched to UTF-8
+    string locale = get_env("LC_ALL");
+    if (locale.empty()) locale = get_env("LC_CTYPE");
+    if (locale.empty()) locale = get_env("LANG");
+    if (!locale.empty()) {
+        transform(locale.begin(), locale.end(), locale.begin(),
+                  [](char ch) { return char(toupper(ch)); });
+        c.utf8 = (locale.find("UTF-8") != string::npos ||
+                  locale.find("UTF8") != string::npos);
+    }
+#endif
+    const string colorterm = get_env("COLORTERM");
+    const string term = get_env("TERM");
+    if (colorterm == "truecolor" || colorterm == "24bit" ||
+        term.find("direct") != string::npos) {
+        c.colors = 1u << 24;
+    } else if (term.find("256color") != string::npos) {
+        c.colors = 256;
+    } else if (term == "linux" || term == "dumb" || term == "ansi" ||
+               term.compare(0, 2, "vt") == 0) {
+        c.colors = 16;
+    }
+    // otherwise truecolor, as assumed so far
+    derive(c);
+    return c;
+}
+
+string Term::get_capability_cache_key() {
+    return sanitize(get_env("TERM") + ';' + get_env("TERM_PROGRAM") + ';' +
+                    get_env("TERM_PROGRAM_VERSION") + ';' +
+                    get_env("VTE_VERSION"));
+}
+
+string Term::get_capability_cache_path() {
+#ifdef _WIN32
+    const string dir = get_env("LOCALAPPDATA");
+#else
+    string dir = get_env("XDG_CACHE_HOME");
+    if (dir.empty()) {
+        const string home = get_env("HOME");
+        if (!home.empty()) dir = home + "/.cache";
+    }
+#endif
+    if (dir.empty()) return "";
+    return dir + "/cpp-terminal-capabilities";
+}
+
+Term::Capabilities Term::detect_capabilities(bool probe_terminal,
+                                             int budget_ms) {
+    Capabilities c = assume_capabilities();
+    string path = get_capability_cache_path();
+    // Without TERM_PROGRAM or VTE_VERSION, the key is the same for many
+    // terminals (e.g. "xterm-256color;;;" for xterm, alacritty and ssh
+    // sessions), so the cache is not used
+    if (get_env("TERM_PROGRAM").empty() && get_env("VTE_VERSION").empty())
+        path.clear();
+    const string key = get_capability_cache_key();
+    if (!path.empty() && read_cache(path, key, c)) {
+        derive(c);
+        return c;
+    }
+    if (probe_terminal && is_stdin_a_tty() && is_stdout_a_tty() &&
+        probe(c, budget_ms) && !path.empty()) {
+        write_cache(path, key, c);
+    }
+    derive(c);
+    return c;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+namespace Term {
+
+// What the terminal supports. The defaults are what has been assumed
+// before anything is known.
+struct Capabilities {
+    bool utf8{true};
+    unsigned colors{1u << 24};     // 16, 256 or 1 << 24 (truecolor)
+    bool synchronized_output{};    // DEC private mode 2026
+    bool kitty_keyboard{};         // the kitty keyboard protocol
+    bool repeat{};                 // REP, known from the version
+    // a newline extends the background to the line end (VS Code), unless
+    // the terminal is known to be another one
+    bool reset_bg_at_eol{true};
+    std::string version;           // XTVERSION, e.g. "XTerm(390)"
+    bool probed{};                 // else assumed from the environment
+};
+
+/* Finds out the capabilities of the terminal on the standard input and
+ * output. The results of probing are cached on disk, keyed by the
+ * environment variables which tell terminals apart (TERM, TERM_PROGRAM,
+ * TERM_PROGRAM_VERSION, VTE_VERSION), so that later launches in the same
+ * terminal skip the round-trips. These variables do not tell all terminals
+ * apart: if neither TERM_PROGRAM nor VTE_VERSION is set (e.g. in xterm,
+ * alacritty or over ssh), the cache is not used and the terminal is probed
+ * each time. Entries expire after a week, so that an upgraded terminal is
+ * probed again. Without a cache entry, and if probe is
+ * true, all queries are written at once and the responses are awaited for
+ * budget_ms milliseconds at most; this needs raw input. Otherwise, or if
+ * the terminal does not answer in time, the capabilities are assumed from
+ * the environment (COLORTERM, TERM, the locale). Responses which arrive
+ * after the budget is spent are read as keys.
+ */
+Capabilities detect_capabilities(bool probe, int budget_ms = 200);
+
+// the capabilities assumed from the environment
+Capabilities assume_capabilities();
+
+// the key of the terminal in the cache
+std::string get_capability_cache_key();
+// $XDG_CACHE_HOME/cpp-terminal-capabilities or the like, empty if there is
+// no place for it
+std::string get_capability_cache_path();
+
+}  // namespace Term
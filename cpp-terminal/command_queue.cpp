@@ -0,0 +1,161 @@
+#include "command_queue.hpp"
+#include "utf8.hpp"
+#include <memory>
+
+using namespace std;
+
+/**********************
+ * Term::CommandQueue
+ **********************
+ */
+
+Term::CommandQueue::CommandQueue(Window& window)
+    : win(&window)
+    , head(&stub)
+    , tail(&stub)
+{}
+
+Term::CommandQueue::~CommandQueue() {
+    while (Command* cmd = pop()) delete cmd;
+}
+
+Term::Window& Term::CommandQueue::get_window() const {
+    return *win;
+}
+
+void Term::CommandQueue::push(Command* cmd) {
+    cmd->next.store(nullptr, memory_order_relaxed);
+    // Between the exchange and the link, the consumer sees the list end at
+    // prev, and simply takes cmd with the next apply()
+    Command* prev = head.exchange(cmd, memory_order_acq_rel);
+    prev->next.store(cmd, memory_order_release);
+}
+
+Term::CommandQueue::Command* Term::CommandQueue::pop() {
+    Command* t = tail;
+    Command* next = t->next.load(memory_order_acquire);
+    if (t == &stub) {
+        if (!next) return nullptr;
+        tail = next;
+        t = next;
+        next = next->next.load(memory_order_acquire);
+    }
+    if (next) {
+        tail = next;
+        return t;
+    }
+    if (t != head.load(memory_order_acquire)) {
+        // a producer has not linked its command yet
+        return nullptr;
+    }
+    // t is the last command: put the stub behind it, so that it can go
+    push(&stub);
+    next = t->next.load(memory_order_acquire);
+    if (next) {
+        tail = next;
+        return t;
+    }
+    return nullptr;
+}
+
+void Term::CommandQueue::write(size_t x, size_t y, const u32string& s,
+                               FgColor a_fg, BgColor a_bg, style a_style) {
+    Command* cmd = new Command(Command::WRITE, x, y);
+    cmd->text = s;
+    cmd->cell = Cell(U'\0', a_fg, a_bg, a_style);
+    push(cmd);
+}
+
+void Term::CommandQueue::write(size_t x, size_t y, const string& s,
+                               FgColor a_fg, BgColor a_bg, style a_style) {
+    write(x, y, utf8_decode(s), a_fg, a_bg, a_style);
+}
+
+void Term::CommandQueue::write_ansi(string s) {
+    Command* cmd = new Command(Command::WRITE_ANSI);
+    cmd->bytes = move(s);
+    push(cmd);
+}
+
+void Term::CommandQueue::set_cell(size_t x, size_t y, const Cell& c) {
+    Command* cmd = new Command(Command::SET_CELL, x, y);
+    cmd->cell = c;
+    push(cmd);
+}
+
+void Term::CommandQueue::fill_fg(size_t x, size_t y,
+                                 size_t width, size_t height, FgColor c) {
+    Command* cmd = new Command(Command::FILL_FG, x, y, width, height);
+    cmd->cell.cell_fg = c;
+    push(cmd);
+}
+
+void Term::CommandQueue::fill_bg(size_t x, size_t y,
+                                 size_t width, size_t height, BgColor c) {
+    Command* cmd = new Command(Command::FILL_BG, x, y, width, height);
+    cmd->cell.cell_bg = c;
+    push(cmd);
+}
+
+void Term::CommandQueue::fill_style(size_t x, size_t y,
+                                    size_t width, size_t height, style st) {
+    Command* cmd = new Command(Command::FILL_STYLE, x, y, width, height);
+    cmd->cell.cell_style = st;
+    push(cmd);
+}
+
+void Term::CommandQueue::clear_row(size_t y) {
+    Command* cmd = new Command(Command::CLEAR_ROW, 0, y);
+    push(cmd);
+}
+
+void Term::CommandQueue::set_cursor(size_t x, size_t y) {
+    Command* cmd = new Command(Command::SET_CURSOR, x, y);
+    push(cmd);
+}
+
+void Term::CommandQueue::execute(const Command& cmd) {
+    const Cell& c = cmd.cell;
+    switch (cmd.type) {
+    case Command::WRITE:
+        win->set_cursor(cmd.x, cmd.y);
+        win->write(cmd.text, c.cell_fg, c.cell_bg, c.cell_style);
+        break;
+    case Command::WRITE_ANSI:
+        win->write_ansi(cmd.bytes);
+        break;
+    case Command::SET_CELL:
+        win->set_cell(cmd.x, cmd.y, c);
+        break;
+    case Command::FILL_FG:
+        win->fill_fg(cmd.x, cmd.y, cmd.width, cmd.height, c.cell_fg);
+        break;
+    case Command::FILL_BG:
+        win->fill_bg(cmd.x, cmd.y, cmd.width, cmd.height, c.cell_bg);
+        break;
+    case Command::FILL_STYLE:
+        win->fill_style(cmd.x, cmd.y, cmd.width, cmd.height, c.cell_style);
+        break;
+    case Command::CLEAR_ROW:
+        win->clear_row(cmd.y);
+        break;
+    case Command::SET_CURSOR:
+        win->set_cursor(cmd.x, cmd.y);
+        break;
+    }
+}
+
+size_t Term::CommandQueue::apply(size_t max) {
+    size_t n = 0;
+    for (; n != max; ++n) {
+        unique_ptr<Command> cmd(pop());
+        if (!cmd) break;
+        execute(*cmd);
+    }
+    return n;
+}
+
+bool Term::CommandQueue::is_empty() const {
+    // drained, the list consists of the stub only
+    return tail == &stub && head.load(memory_order_acquire) == &stub;
+}
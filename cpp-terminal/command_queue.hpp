@@ -0,0 +1,86 @@
+#pragma once
+
+#include "window.hpp"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace Term {
+
+/* A queue of drawing commands for one window, so that worker threads can
+ * update the window without locking it. Any number of threads may enqueue
+ * commands at the same time; a single thread, e.g. the render thread,
+ * applies them in order (per producer) by apply(), typically right before
+ * draw_window(). Window itself is not thread safe: while commands may be
+ * applied, only the applying thread may touch the window.
+ * Enqueueing is lock-free and wait-free, a single atomic exchange, and
+ * never waits for the window or the terminal. The commands are allocated
+ * by the producer, though, and the text is converted there as well.
+ */
+class CommandQueue {
+   protected :
+    struct Command {
+        enum Type : uint8_t {
+            WRITE, WRITE_ANSI, SET_CELL, FILL_FG, FILL_BG, FILL_STYLE,
+            CLEAR_ROW, SET_CURSOR
+        } type{};
+        size_t x{}, y{}, width{}, height{};
+        std::u32string text; // WRITE
+        std::string bytes;   // WRITE_ANSI
+        Cell cell;           // SET_CELL; the attributes of WRITE and FILL_*
+        std::atomic<Command*> next{nullptr};
+
+        explicit Command(Type t = WRITE, size_t x_ = 0, size_t y_ = 0,
+                         size_t width_ = 0, size_t height_ = 0)
+            : type(t), x(x_), y(y_), width(width_), height(height_) {}
+    };
+
+    Window* win;
+    // An intrusive MPSC list: the producers exchange head, the consumer
+    // follows the next pointers from tail. stub keeps the list non-empty.
+    std::atomic<Command*> head;
+    Command* tail;
+    Command stub;
+
+    void push(Command*);
+    // the oldest command, or nullptr if none is complete yet
+    Command* pop();
+    void execute(const Command&);
+
+   public :
+    explicit CommandQueue(Window&);
+    CommandQueue(const CommandQueue&) = delete;
+    CommandQueue& operator=(const CommandQueue&) = delete;
+    // discards the commands not applied yet
+    ~CommandQueue();
+
+    Window& get_window() const;
+
+    // Producer side, for any thread. Like the Window methods of the same
+    // names; write() moves the cursor to (x, y) first.
+    void write(size_t x, size_t y, const std::u32string&,
+               FgColor = fg::unspecified,
+               BgColor = bg::unspecified,
+               style = style::unspecified);
+    void write(size_t x, size_t y, const std::string&,
+               FgColor = fg::unspecified,
+               BgColor = bg::unspecified,
+               style = style::unspecified);
+    // a chunk of a write_ansi() stream, continuing at the cursor
+    void write_ansi(std::string);
+    void set_cell(size_t x, size_t y, const Cell&);
+    void fill_fg(size_t x, size_t y, size_t width, size_t height, FgColor);
+    void fill_bg(size_t x, size_t y, size_t width, size_t height, BgColor);
+    void fill_style(size_t x, size_t y, size_t width, size_t height, style);
+    void clear_row(size_t y);
+    void set_cursor(size_t x, size_t y);
+
+    // Consumer side, for one thread at a time. Applies up to max commands
+    // to the window, oldest first, and returns how many. A command which
+    // throws is dropped; the ones after it remain queued.
+    size_t apply(size_t max = SIZE_MAX);
+    // true if there is nothing to apply, e.g. to skip a redraw
+    bool is_empty() const;
+};
+
+}  // namespace Term
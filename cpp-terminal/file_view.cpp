@@ -0,0 +1,259 @@
+#include "file_view.hpp"
+#include "grapheme.hpp"
+#include "utf8.hpp"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+/************************
+ * Term::FileViewWindow
+ ************************
+ */
+
+Term::FileViewWindow::FileViewWindow(const string& path,
+                                     size_t width, size_t height)
+    : Window(width, height)
+    , view(height)
+{
+    hide_cursor();
+    map_file(path);
+    if (data_size) {
+        line_starts.push_back(0);
+        indexed_lines = 1;
+    }
+    indexer = thread(&FileViewWindow::build_index, this);
+}
+
+Term::FileViewWindow::~FileViewWindow() {
+    stop_indexing = true;
+    if (indexer.joinable()) indexer.join();
+    unmap_file();
+}
+
+void Term::FileViewWindow::map_file(const string& path) {
+#ifdef _WIN32
+    file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        throw runtime_error("FileViewWindow: could not open " + path);
+    }
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(file_handle, &sz)) {
+        unmap_file();
+        throw runtime_error("FileViewWindow: GetFileSizeEx() failed");
+    }
+    data_size = static_cast<size_t>(sz.QuadPart);
+    if (!data_size) return;
+    mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY,
+                                        0, 0, nullptr);
+    if (!mapping_handle) {
+        unmap_file();
+        throw runtime_error("FileViewWindow: CreateFileMapping() failed");
+    }
+    data = static_cast<const char*>(
+        MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (!data) {
+        unmap_file();
+        throw runtime_error("FileViewWindow: MapViewOfFile() failed");
+    }
+#else
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw runtime_error("FileViewWindow: could not open " + path);
+    }
+    struct stat st {};
+    if (fstat(fd, &st) == -1) {
+        unmap_file();
+        throw runtime_error("FileViewWindow: fstat() failed");
+    }
+    data_size = static_cast<size_t>(st.st_size);
+    if (!data_size) return;
+    void* p = mmap(nullptr, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        data_size = 0;
+        unmap_file();
+        throw runtime_error("FileViewWindow: mmap() failed");
+    }
+    data = static_cast<const char*>(p);
+    // the indexer reads the file front to back
+    madvise(p, data_size, MADV_SEQUENTIAL);
+#endif
+}
+
+void Term::FileViewWindow::unmap_file() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping_handle) CloseHandle(mapping_handle);
+    if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+    mapping_handle = nullptr;
+    file_handle = INVALID_HANDLE_VALUE;
+#else
+    if (data) munmap(const_cast<char*>(data), data_size);
+    if (fd != -1) close(fd);
+    fd = -1;
+#endif
+    data = nullptr;
+    data_size = 0;
+}
+
+void Term::FileViewWindow::build_index() {
+    // Scan the file in chunks, so that the mutex is held only briefly
+    const size_t chunk_size = 1 << 20;
+    vector<size_t> found;
+    for (size_t pos = 0; pos < data_size && !stop_indexing;) {
+        size_t end = min(data_size, pos + chunk_size);
+        const char* p = data + pos;
+        const char* chunk_end = data + end;
+        while ((p = static_cast<const char*>(
+                    memchr(p, '\n', static_cast<size_t>(chunk_end - p))))) {
+            ++p;
+            size_t start = static_cast<size_t>(p - data);
+            // a final LF does not start another line
+            if (start < data_size) found.push_back(start);
+            if (p == chunk_end) break;
+        }
+        if (found.size()) {
+            lock_guard<mutex> lock(index_mutex);
+            line_starts.insert(line_starts.end(), found.begin(), found.end());
+            indexed_lines = line_starts.size();
+        }
+        found.clear();
+        pos = end;
+    }
+    index_complete = true;
+}
+
+void Term::FileViewWindow::decode_line(size_t begin, vector<Cell>& row) const {
+    row.clear();
+    // Decode no more than could be displayed: w graphemes plus one more
+    // for the segmentation of the last one. Only clusters longer than
+    // MAX_DECODED_CLUSTER codepoints (of up to 4 bytes) may be cut off.
+    size_t limit = min(data_size,
+                       begin + (w + 1) * MAX_DECODED_CLUSTER * 4);
+    const char* p = data + begin;
+    const void* lf = memchr(p, '\n', limit - begin);
+    size_t end = (lf ? static_cast<size_t>(static_cast<const char*>(lf) -
+                                           data)
+                     : limit);
+    u32string s32;
+    utf8_decode(p, end - begin, s32);
+    Cell blank = get_blank_cell();
+    blank.set_char(U' ');
+    size_t sz = 0;
+    for (size_t i = 0; i < s32.size() && row.size() < w; i += sz) {
+        sz = grapheme_length(s32.data() + i, s32.size() - i);
+        if (s32[i] == Key::TAB) {
+            if (!tabsize) continue;
+            size_t blanks = tabsize - (row.size() % tabsize);
+            row.resize(min(w, row.size() + blanks), blank);
+            continue;
+        }
+        if (s32[i] < U' ' || s32[i] > UTF8_MAX) continue; // incl. CR
+        size_t cells = grapheme_width(s32.data() + i, sz);
+        // a wide grapheme which does not fit completely is left out
+        if (row.size() + cells > w) break;
+        row.push_back(blank);
+        row.back().set_grapheme(s32.substr(i, sz));
+        if (cells == 2) {
+            row.push_back(blank);
+            row.back().set_char(Cell::WIDE_TAIL);
+        }
+    }
+}
+
+void Term::FileViewWindow::refresh_view() const {
+    size_t known = indexed_lines;
+    // the view is outdated if lines have been indexed in the meantime
+    // which would be visible
+    if (!view_dirty && (view_lines == h || known <= top + view_lines)) {
+        return;
+    }
+    view.resize(h);
+    lock_guard<mutex> lock(index_mutex);
+    known = line_starts.size();
+    view_lines = 0;
+    for (size_t y = 0; y != h; ++y) {
+        if (top + y < known) {
+            decode_line(line_starts[top + y], view[y]);
+            ++view_lines;
+        } else {
+            view[y].clear();
+        }
+    }
+    view_dirty = false;
+}
+
+const vector<Term::Cell>* Term::FileViewWindow::find_row(size_t y) const {
+    if (y >= h) return nullptr;
+    refresh_view();
+    return &view[y];
+}
+
+vector<Term::Cell>& Term::FileViewWindow::access_row(size_t y) {
+    refresh_view();
+    return view[y];
+}
+
+size_t Term::FileViewWindow::get_line_count() const {
+    return indexed_lines;
+}
+
+bool Term::FileViewWindow::is_index_complete() const {
+    return index_complete;
+}
+
+void Term::FileViewWindow::wait_for_index() {
+    if (indexer.joinable()) indexer.join();
+}
+
+size_t Term::FileViewWindow::get_top() const {
+    return top;
+}
+
+void Term::FileViewWindow::scroll_to(size_t line) {
+    size_t count = indexed_lines;
+    size_t max_top = (count > h ? count - h : 0);
+    line = min(line, max_top);
+    if (line == top) return;
+    top = line;
+    view_dirty = true;
+}
+
+void Term::FileViewWindow::scroll_up(size_t n) {
+    scroll_to(top > n ? top - n : 0);
+}
+
+void Term::FileViewWindow::scroll_down(size_t n) {
+    scroll_to(top + n);
+}
+
+void Term::FileViewWindow::scroll_to_bottom() {
+    scroll_to(indexed_lines);
+}
+
+void Term::FileViewWindow::set_w(size_t new_w) {
+    Window::set_w(new_w);
+    view_dirty = true;
+}
+
+void Term::FileViewWindow::set_h(size_t new_h) {
+    Window::set_h(new_h);
+    view_dirty = true;
+}
+
+void Term::FileViewWindow::set_grid(const vector<SharedRow>&) {
+    throw logic_error("FileViewWindow::set_grid(): the view shows the file");
+}
+
+void Term::FileViewWindow::clear_grid() {
+    Window::clear_grid();
+    view_dirty = true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "window.hpp"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Term {
+
+/* A read-only window onto a (possibly huge) text file. The file is memory
+ * mapped, and a background thread builds the index of line offsets while
+ * the window is already usable. Only the lines inside the viewport are
+ * decoded, and only when the window is actually read, e.g. by
+ * merge_children() or draw_window(). Memory use is thus bounded by the
+ * viewport plus the line index.
+ * Cells modified through the Window API (e.g. to highlight a search match)
+ * keep their changes only until the viewport moves.
+ */
+class FileViewWindow : public Window {
+   protected :
+    // bounds the bytes decoded per line, see decode_line()
+    enum { MAX_DECODED_CLUSTER = 16 };
+
+    const char* data{};    // the mapped file
+    size_t data_size{};
+#ifdef _WIN32
+    HANDLE file_handle{INVALID_HANDLE_VALUE};
+    HANDLE mapping_handle{};
+#else
+    int fd{-1};
+#endif
+
+    // line index, filled by the indexer thread
+    mutable std::mutex index_mutex;
+    std::vector<size_t> line_starts;     // guarded by index_mutex
+    std::atomic<size_t> indexed_lines{}; // line_starts.size(), published
+    std::atomic<bool> index_complete{};
+    std::atomic<bool> stop_indexing{};
+    std::thread indexer;
+
+    size_t top{}; // line shown in window row 0
+
+    // the decoded viewport
+    mutable std::vector<std::vector<Cell>> view;
+    mutable bool view_dirty{true};
+    mutable size_t view_lines{}; // lines of the file covered by view
+
+    void map_file(const std::string&);
+    void unmap_file();
+    void build_index();
+    // decodes the visible lines into view, if necessary
+    void refresh_view() const;
+    void decode_line(size_t begin, std::vector<Cell>&) const;
+
+    const std::vector<Cell>* find_row(size_t y) const override;
+    std::vector<Cell>& access_row(size_t y) override;
+
+   public :
+    FileViewWindow(const std::string& path, size_t width, size_t height);
+    FileViewWindow(const FileViewWindow&) = delete;
+    FileViewWindow& operator=(const FileViewWindow&) = delete;
+    ~FileViewWindow() override;
+
+    // number of lines indexed so far
+    size_t get_line_count() const;
+    bool is_index_complete() const;
+    // blocks until the indexer thread has finished
+    void wait_for_index();
+
+    size_t get_top() const; // the line shown in window row 0
+    void scroll_to(size_t line);
+    void scroll_up(size_t n = 1);
+    void scroll_down(size_t n = 1);
+    void scroll_to_bottom();
+
+    void set_w(size_t) override;
+    void set_h(size_t) override;
+    // discards modifications of the visible cells
+    void clear_grid() override;
+    // throws, as the view is generated
+    using Window::set_grid;
+    void set_grid(const std::vector<SharedRow>&) override;
+};
+
+}  // namespace Term
@@ -0,0 +1,83 @@
+#include "grapheme.hpp"
+
+using namespace std;
+
+namespace {
+#define GCB_BIT(c) (1u << static_cast<unsigned>(Term::gcb::c))
+
+// the classes which may follow any class but the controls (GB9, GB9a)
+const unsigned EXTEND = GCB_BIT(Extend) | GCB_BIT(ZWJ) | GCB_BIT(SpacingMark);
+
+// no_break[prev] has the bits of those classes set which do not start a
+// new cluster after prev, according to the pair rules GB3 to GB9b. The
+// rules which depend on more than the previous codepoint (GB11 to GB13)
+// are applied by grapheme_length() itself.
+const uint16_t no_break[] = {
+    EXTEND,                                     // Other
+    GCB_BIT(LF),                                // CR (GB3, GB4)
+    0,                                          // LF (GB4)
+    0,                                          // Control (GB4)
+    EXTEND,                                     // Extend
+    EXTEND,                                     // ZWJ
+    EXTEND,                                     // Regional_Indicator
+    0xffff & ~(GCB_BIT(CR) | GCB_BIT(LF) |      // Prepend (GB5, GB9b)
+               GCB_BIT(Control)),
+    EXTEND,                                     // SpacingMark
+    EXTEND | GCB_BIT(L) | GCB_BIT(V) |          // L (GB6)
+        GCB_BIT(LV) | GCB_BIT(LVT),
+    EXTEND | GCB_BIT(V) | GCB_BIT(T),           // V (GB7)
+    EXTEND | GCB_BIT(T),                        // T (GB8)
+    EXTEND | GCB_BIT(V) | GCB_BIT(T),           // LV (GB7)
+    EXTEND | GCB_BIT(T),                        // LVT (GB8)
+};
+
+#undef GCB_BIT
+} // namespace
+
+size_t Term::grapheme_length(const char32_t* s, size_t n) {
+    using Private::char_props;
+    using Private::CHAR_PROPS_EXT_PICT;
+    const unsigned ZWJ = static_cast<unsigned>(gcb::ZWJ);
+    const unsigned EXT = static_cast<unsigned>(gcb::Extend);
+    const unsigned RI = static_cast<unsigned>(gcb::Regional_Indicator);
+    if (!n) return 0;
+    uint8_t props = char_props(s[0]);
+    unsigned prev = props & 0x0f;
+    // GB11: pict after Extended_Pictographic Extend*, pict_zwj if a ZWJ
+    // followed that
+    bool pict = props & CHAR_PROPS_EXT_PICT;
+    bool pict_zwj = false;
+    // GB12, GB13: number of consecutive regional indicators so far
+    size_t ri_count = (prev == RI);
+    size_t i = 1;
+    for (; i != n; ++i) {
+        props = char_props(s[i]);
+        const unsigned cur = props & 0x0f;
+        if (!((no_break[prev] >> cur) & 1) &&
+            !(pict_zwj && (props & CHAR_PROPS_EXT_PICT)) &&
+            !(cur == RI && (ri_count & 1))) {
+            break;
+        }
+        pict_zwj = (pict && cur == ZWJ);
+        pict = (props & CHAR_PROPS_EXT_PICT) || (pict && cur == EXT);
+        ri_count = (cur == RI ? ri_count + 1 : 0);
+        prev = cur;
+    }
+    return i;
+}
+
+size_t Term::grapheme_width(const char32_t* s, size_t n) {
+    if (!n) return 1;
+    if (get_gcb(s[0]) == gcb::Regional_Indicator) {
+        // a pair of regional indicators is displayed as flag
+        return n > 1 ? 2 : 1;
+    }
+    size_t width = char_width(s[0]);
+    if (width == 1 && is_extended_pictographic(s[0])) {
+        // VARIATION SELECTOR-16 requests the (wide) emoji presentation
+        for (size_t i = 1; i != n; ++i) {
+            if (s[i] == U'\xfe0f') return 2;
+        }
+    }
+    return width ? width : 1;
+}
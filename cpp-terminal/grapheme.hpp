@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Term {
+
+// Grapheme_Cluster_Break property values (Unicode Standard Annex #29)
+enum class gcb : uint8_t {
+    Other,
+    CR,
+    LF,
+    Control,
+    Extend,
+    ZWJ,
+    Regional_Indicator,
+    Prepend,
+    SpacingMark,
+    L,
+    V,
+    T,
+    LV,
+    LVT
+};
+
+namespace Private {
+// Two-level lookup table of codepoint properties, generated by
+// tools/gen_unicode_tables.py into unicode_tables.cpp. Each byte holds
+// the gcb value (bits 0-3), Extended_Pictographic (bit 4) and the display
+// width (bits 5-6) of one codepoint.
+enum { CHAR_PROPS_SHIFT = 7, CHAR_PROPS_EXT_PICT = 0x10, CHAR_PROPS_WIDTH = 5 };
+extern const uint8_t char_props_index[];
+extern const uint8_t char_props_data[];
+
+inline uint8_t char_props(char32_t c) {
+    // anything beyond Unicode is treated like an unassigned codepoint
+    if (c > 0x10ffff) return 1 << CHAR_PROPS_WIDTH;
+    const size_t block = char_props_index[c >> CHAR_PROPS_SHIFT];
+    return char_props_data[(block << CHAR_PROPS_SHIFT) |
+                           (c & ((1u << CHAR_PROPS_SHIFT) - 1))];
+}
+}  // namespace Private
+
+inline gcb get_gcb(char32_t c) {
+    return static_cast<gcb>(Private::char_props(c) & 0x0f);
+}
+
+inline bool is_extended_pictographic(char32_t c) {
+    return Private::char_props(c) & Private::CHAR_PROPS_EXT_PICT;
+}
+
+// The number of terminal columns taken by c alone: 2 for East Asian wide
+// and fullwidth characters, 0 for combining marks and controls, else 1
+inline size_t char_width(char32_t c) {
+    return Private::char_props(c) >> Private::CHAR_PROPS_WIDTH;
+}
+
+// The length (in codepoints) of the grapheme cluster starting at s, which
+// is at most n. Segmentation follows the extended grapheme cluster rules
+// of UAX #29, driven by the tables above.
+size_t grapheme_length(const char32_t* s, size_t n);
+inline size_t grapheme_length(const std::u32string& s, size_t pos = 0) {
+    return grapheme_length(s.data() + pos, s.size() - pos);
+}
+
+// The number of cells taken by the grapheme cluster s[0..n): 1 or 2. Even
+// clusters of zero width take one cell.
+size_t grapheme_width(const char32_t* s, size_t n);
+inline size_t grapheme_width(const std::u32string& s) {
+    return grapheme_width(s.data(), s.size());
+}
+
+}  // namespace Term
@@ -1,5 +1,6 @@
 #include "input.hpp"
 #include "platform.hpp"
+#include "utf8.hpp"
 #include <chrono>
 #include <thread>
 
@@ -290,4 +291,67 @@ char32_t Term::Private::decode_sequence(const u32string& seq) {
         return ALT | seq[1];
     }
     return Key::UNKNOWN;
-}
\ No newline at end of file
+}
+string Term::Private::encode_key(char32_t key, bool application_cursor) {
+    if (key == Key::UNKNOWN) return "";
+    const char32_t mods = key & (SHIFT | ALT | CTRL);
+    char32_t base = key & ~(SHIFT | ALT | CTRL);
+    // the modifier parameter of CSI sequences: 1 + shift + 2 alt + 4 ctrl
+    const int m = 1 + ((mods & SHIFT) ? 1 : 0) + ((mods & ALT) ? 2 : 0) +
+                  ((mods & CTRL) ? 4 : 0);
+    string res;
+    // keys sent as CSI 1 ; m letter, or unmodified as CSI/SS3 letter
+    char letter = 0;
+    bool ss3 = application_cursor;
+    // keys sent as CSI number ; m ~
+    int number = 0;
+    switch (base) {
+    case ARROW_UP: letter = 'A'; break;
+    case ARROW_DOWN: letter = 'B'; break;
+    case ARROW_RIGHT: letter = 'C'; break;
+    case ARROW_LEFT: letter = 'D'; break;
+    case HOME: letter = 'H'; break;
+    case END: letter = 'F'; break;
+    case NUMERIC_5: letter = 'E'; ss3 = false; break;
+    case F1: letter = 'P'; ss3 = true; break;
+    case F2: letter = 'Q'; ss3 = true; break;
+    case F3: letter = 'R'; ss3 = true; break;
+    case F4: letter = 'S'; ss3 = true; break;
+    case INSERT: number = 2; break;
+    case DEL: number = 3; break;
+    case PAGE_UP: number = 5; break;
+    case PAGE_DOWN: number = 6; break;
+    case F5: number = 15; break;
+    case F6: number = 17; break;
+    case F7: number = 18; break;
+    case F8: number = 19; break;
+    case F9: number = 20; break;
+    case F10: number = 21; break;
+    case F11: number = 23; break;
+    case F12: number = 24; break;
+    default: break;
+    }
+    if (letter) {
+        if (m > 1) return "\x1b[1;" + to_string(m) + letter;
+        return string(ss3 ? "\x1bO" : "\x1b[") + letter;
+    }
+    if (number) {
+        res = "\x1b[" + to_string(number);
+        if (m > 1) res += ";" + to_string(m);
+        return res + "~";
+    }
+    if (base >= ARROW_UP) return ""; // a non-printable not known here
+    if (base == TAB && (mods & SHIFT)) return "\x1b[Z";
+    if (mods & ALT) res.push_back('\x1b');
+    if (base == BACKSPACE) {
+        // see decode_sequence()
+        res.push_back((mods & CTRL) ? '\x08' : '\x7f');
+    } else if ((mods & CTRL) && base >= U'@' && base <= U'_') {
+        res.push_back(static_cast<char>(base & 0x1f));
+    } else if ((mods & CTRL) && base >= U'a' && base <= U'z') {
+        res.push_back(static_cast<char>(base & 0x1f));
+    } else {
+        utf8_encode(&base, 1, res);
+    }
+    return res;
+}
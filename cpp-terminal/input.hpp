@@ -93,6 +93,11 @@ extern std::map<std::u32string, char32_t> sequences;
 std::u32string read_sequence();
 std::u32string read_sequence0();
 char32_t decode_sequence(const std::u32string&);
+// The reverse: the bytes (utf8) an xterm sends for the key, e.g. to pass it
+// on to a program running in a PtyWindow. In application cursor mode,
+// the arrow keys, HOME and END are sent as SS3 sequences. Returns an empty
+// string for Key::UNKNOWN.
+std::string encode_key(char32_t key, bool application_cursor = false);
 
 } // namespace Term::Private
 
@@ -0,0 +1,184 @@
+#include "output.hpp"
+#include "base.hpp"
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+using namespace std;
+
+/***************************
+ * Term::NonBlockingOutput
+ ***************************
+ */
+
+Term::NonBlockingOutput::NonBlockingOutput(int fd_)
+    : fd(fd_)
+{
+#ifdef _WIN32
+    throw runtime_error("NonBlockingOutput: not supported");
+#else
+    old_flags = ::fcntl(fd, F_GETFL);
+    if (old_flags == -1 ||
+        ::fcntl(fd, F_SETFL, old_flags | O_NONBLOCK) == -1) {
+        throw runtime_error(string("NonBlockingOutput: fcntl() failed: ") +
+                            strerror(errno));
+    }
+#endif
+}
+
+Term::NonBlockingOutput::~NonBlockingOutput() {
+#ifndef _WIN32
+    // the descriptor is shared with the shell, it must not stay
+    // non-blocking
+    ::fcntl(fd, F_SETFL, old_flags);
+    while (offset != pending.size()) {
+        ssize_t r = ::write(fd, pending.data() + offset,
+                            pending.size() - offset);
+        if (r > 0) offset += static_cast<size_t>(r);
+        else if (r < 0 && errno == EINTR) continue;
+        else break;
+    }
+#endif
+}
+
+int Term::NonBlockingOutput::get_fd() const {
+    return fd;
+}
+
+size_t Term::NonBlockingOutput::write_some(const char* s, size_t n) {
+    size_t done = 0;
+#ifndef _WIN32
+    while (done != n) {
+        ssize_t r = ::write(fd, s + done, n - done);
+        if (r > 0) {
+            done += static_cast<size_t>(r);
+            continue;
+        }
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        throw runtime_error(string("NonBlockingOutput: write() failed: ") +
+                            strerror(errno));
+    }
+#endif
+    written += done;
+    return done;
+}
+
+void Term::NonBlockingOutput::write(const string& s) {
+    if (is_pending()) {
+        pending.append(s);
+        flush();
+        return;
+    }
+    // nothing queued: s is written right away, only the rest is kept,
+    // from the start of the character or sequence it begins in
+    const size_t done = write_some(s.data(), s.size());
+    if (done == s.size()) return;
+    size_t start = 0;
+    for (size_t end; (end = unit_end(s, start)) <= done; ) start = end;
+    pending.assign(s, start, string::npos);
+    offset = done - start;
+}
+
+size_t Term::NonBlockingOutput::flush() {
+    const size_t done =
+        write_some(pending.data() + offset, pending.size() - offset);
+    offset += done;
+    if (offset == pending.size()) {
+        // an idle output holds no memory
+        string().swap(pending);
+        offset = 0;
+    }
+    return done;
+}
+
+bool Term::NonBlockingOutput::is_pending() const {
+    return offset != pending.size();
+}
+
+size_t Term::NonBlockingOutput::get_pending() const {
+    return pending.size() - offset;
+}
+
+size_t Term::NonBlockingOutput::unit_end(const string& s, size_t i) {
+    const size_t n = s.size();
+    const unsigned char c = static_cast<unsigned char>(s[i]);
+    auto byte = [&](size_t j) {
+        return static_cast<unsigned char>(s[j]);
+    };
+    if (c == 0x1b) {
+        if (++i == n) return n;
+        const unsigned char kind = byte(i++);
+        if (kind == '[') {
+            // parameters and intermediates, up to the final byte
+            while (i != n && (byte(i) < 0x40 || byte(i) > 0x7e)) ++i;
+            return i == n ? n : i + 1;
+        }
+        if (kind == ']' || kind == 'P' || kind == '_' || kind == '^') {
+            // a string, up to BEL or ST
+            for (; i != n; ++i) {
+                if (byte(i) == 0x07) return i + 1;
+                if (byte(i) == 0x1b && i + 1 != n && byte(i + 1) == '\\')
+                    return i + 2;
+            }
+            return n;
+        }
+        // intermediates, up to the final byte
+        if (kind >= 0x20 && kind <= 0x2f) {
+            while (i != n && byte(i) >= 0x20 && byte(i) <= 0x2f) ++i;
+            return i == n ? n : i + 1;
+        }
+        return i;
+    }
+    // a UTF-8 sequence
+    size_t len = 1;
+    if (c >= 0xf0) len = 4;
+    else if (c >= 0xe0) len = 3;
+    else if (c >= 0xc0) len = 2;
+    size_t end = i + 1;
+    while (end != n && end - i < len && (byte(end) & 0xc0) == 0x80) ++end;
+    return end;
+}
+
+bool Term::NonBlockingOutput::begin_frame() {
+    flush();
+    if (!is_pending()) return false;
+    // pending starts at a unit, the one being written is finished
+    size_t cut = 0;
+    while (cut < offset) cut = unit_end(pending, cut);
+    if (cut == pending.size()) return false;
+    abandoned += pending.size() - cut;
+    pending.resize(cut);
+    // the frame's end of synchronized update (DEC mode 2026) may be cut
+    // off; terminals which do not know the mode ignore this
+    pending.append(color(style::reset) + "\x1b[?2026l");
+    flush();
+    return true;
+}
+
+void Term::NonBlockingOutput::discard() {
+    abandoned += pending.size() - offset;
+    string().swap(pending);
+    offset = 0;
+}
+
+size_t Term::NonBlockingOutput::get_written_count() const {
+    return written;
+}
+
+size_t Term::NonBlockingOutput::get_abandoned_count() const {
+    return abandoned;
+}
+
+size_t Term::NonBlockingOutput::get_memory_usage() const {
+    // short strings are kept inside the object
+    const size_t heap = pending.capacity() > string().capacity()
+                            ? pending.capacity() + 1 : 0;
+    return sizeof(*this) + heap;
+}
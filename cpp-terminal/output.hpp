@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Term {
+
+/* Writes to the terminal without ever blocking, e.g. on a slow ssh link:
+ * the file descriptor is switched to non-blocking mode, and what it does
+ * not take at once is kept and written by the next calls of flush(). The
+ * event loop calls flush() when the descriptor is writable, i.e. polls
+ * get_fd() for POLLOUT while is_pending(). Memory is held only while
+ * something is pending.
+ * begin_frame() abandons the remainder of a frame which is still pending
+ * when a newer one is about to be written, so that the terminal never
+ * lags behind by more than about one frame. The output is cut right after
+ * the character or escape sequence being written; then the attributes are
+ * reset and synchronized update (DEC mode 2026), which the frame may have
+ * begun, is ended. Other modes are not restored: the cursor may remain
+ * hidden until the next frame shows it. Which cells the terminal has
+ * received is unknown, so the next frame has to be drawn completely
+ * (render_window() always does).
+ * While a NonBlockingOutput exists, do not write to its descriptor by
+ * other means, e.g. cout for STDOUT_FILENO. POSIX only: the constructor
+ * throws on Windows.
+ */
+class NonBlockingOutput {
+   protected :
+    int fd;
+    int old_flags{-1};        // to be restored
+    std::string pending;      // starts at a character or escape sequence
+    size_t offset{};          // written up to here
+    size_t written{};
+    size_t abandoned{};
+
+    // writes as much of s[0..n) as fd takes, returns how much
+    size_t write_some(const char* s, size_t n);
+    // the end of the character or escape sequence starting at s[i]
+    static size_t unit_end(const std::string& s, size_t i);
+
+   public :
+    explicit NonBlockingOutput(int fd = 1);
+    NonBlockingOutput(const NonBlockingOutput&) = delete;
+    NonBlockingOutput& operator=(const NonBlockingOutput&) = delete;
+    // writes what is pending, blocking, and restores the mode of fd
+    ~NonBlockingOutput();
+
+    int get_fd() const;
+
+    void write(const std::string&);
+    // writes as much as fd takes without blocking, returns how much
+    size_t flush();
+    bool is_pending() const;
+    size_t get_pending() const;
+    // To be called before writing a new frame. Abandons what is pending
+    // after the character or escape sequence being written, and returns
+    // true if anything has been abandoned: the frame has to be drawn
+    // completely then.
+    bool begin_frame();
+    // drops everything pending, e.g. for a peer which has stopped reading
+    void discard();
+
+    size_t get_written_count() const;   // bytes written to fd
+    size_t get_abandoned_count() const; // bytes abandoned
+    // the bytes of memory held, the object included
+    size_t get_memory_usage() const;
+};
+
+}  // namespace Term
@@ -0,0 +1,153 @@
+#include "palette.hpp"
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+
+using namespace std;
+
+namespace {
+
+// xterm's defaults
+const uint8_t ansi_rgb[16][3] = {
+    {0, 0, 0},       {205, 0, 0},     {0, 205, 0},     {205, 205, 0},
+    {0, 0, 238},     {205, 0, 205},   {0, 205, 205},   {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0},     {0, 255, 0},     {255, 255, 0},
+    {92, 92, 255},   {255, 0, 255},   {0, 255, 255},   {255, 255, 255}};
+
+// the levels of the 6 x 6 x 6 color cube
+const uint8_t cube_level[6] = {0, 95, 135, 175, 215, 255};
+
+struct Lab {
+    float l, a, b;
+};
+
+float lab_f(float t) {
+    return t > 216.f / 24389.f ? cbrt(t) : (24389.f / 27.f * t + 16.f) / 116.f;
+}
+
+// the levels 0-255 of sRGB, linearized
+struct Linear {
+    float value[256];
+    Linear() {
+        for (unsigned v = 0; v != 256; ++v) {
+            const float c = v / 255.f;
+            value[v] = c <= 0.04045f ? c / 12.92f
+                                     : pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+    }
+};
+
+// sRGB, D65
+Lab to_lab(uint8_t r8, uint8_t g8, uint8_t b8) {
+    static const Linear linear;
+    const float r = linear.value[r8];
+    const float g = linear.value[g8];
+    const float b = linear.value[b8];
+    const float x = 0.4124f * r + 0.3576f * g + 0.1805f * b;
+    const float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    const float z = 0.0193f * r + 0.1192f * g + 0.9505f * b;
+    const float fx = lab_f(x / 0.95047f);
+    const float fy = lab_f(y);
+    const float fz = lab_f(z / 1.08883f);
+    return Lab{116.f * fy - 16.f, 500.f * (fx - fy), 200.f * (fy - fz)};
+}
+
+struct Palette {
+    Lab lab[256];
+    Palette() {
+        for (unsigned i = 0; i != 256; ++i) {
+            uint8_t r, g, b;
+            Term::palette_rgb(uint8_t(i), r, g, b);
+            lab[i] = to_lab(r, g, b);
+        }
+    }
+};
+
+// the entry of [first, end) nearest to the color
+uint8_t nearest(unsigned first, unsigned end, uint8_t r, uint8_t g,
+                uint8_t b) {
+    static const Palette palette;
+    const Lab c = to_lab(r, g, b);
+    unsigned best = first;
+    float best_distance = 1e30f;
+    for (unsigned i = first; i != end; ++i) {
+        const Lab& p = palette.lab[i];
+        const float d = (c.l - p.l) * (c.l - p.l) +
+                        (c.a - p.a) * (c.a - p.a) + (c.b - p.b) * (c.b - p.b);
+        if (d < best_distance) {
+            best = i;
+            best_distance = d;
+        }
+    }
+    return uint8_t(best);
+}
+
+// the index of a level of the color cube plus 1, 0 if v is none
+unsigned cube_index(uint8_t v) {
+    if (v == 0) return 1;
+    if (v < 95 || (v - 95) % 40) return 0;
+    return (v - 95) / 40 + 2u;
+}
+
+/* The mapping is memoized in tables of 5 bits per channel: each entry is
+ * computed on first use, from the value in its bin which keeps black and
+ * white exact, so a frame costs a search only for the colors not seen
+ * before. The entries are atomic, as frames may be rendered by several
+ * threads; computing one twice gives the same result. 0: not computed yet.
+ */
+const size_t table_size = 32 * 32 * 32;
+atomic<uint8_t> memo_256[table_size];
+atomic<uint8_t> memo_16[table_size];  // the color plus 1
+
+size_t table_index(uint8_t r, uint8_t g, uint8_t b) {
+    return (size_t(r >> 3) << 10) | (size_t(g >> 3) << 5) | size_t(b >> 3);
+}
+
+uint8_t bin_value(uint8_t v) {
+    return uint8_t((v & 0xf8) | v >> 5);
+}
+
+}  // namespace
+
+uint8_t Term::rgb_to_256(uint8_t r, uint8_t g, uint8_t b) {
+    // the entries of the palette map to themselves
+    const unsigned cr = cube_index(r), cg = cube_index(g), cb = cube_index(b);
+    if (cr && cg && cb) return uint8_t(16 + 36 * (cr - 1) + 6 * (cg - 1) +
+                                       (cb - 1));
+    if (r == g && g == b && r >= 8 && r <= 238 && (r - 8) % 10 == 0) {
+        return uint8_t(232 + (r - 8) / 10);
+    }
+    atomic<uint8_t>& entry = memo_256[table_index(r, g, b)];
+    uint8_t index = entry.load(memory_order_relaxed);
+    if (!index) {
+        index = nearest(16, 256, bin_value(r), bin_value(g), bin_value(b));
+        entry.store(index, memory_order_relaxed);
+    }
+    return index;
+}
+
+uint8_t Term::rgb_to_16(uint8_t r, uint8_t g, uint8_t b) {
+    atomic<uint8_t>& entry = memo_16[table_index(r, g, b)];
+    uint8_t index = entry.load(memory_order_relaxed);
+    if (!index) {
+        index = uint8_t(
+            nearest(0, 16, bin_value(r), bin_value(g), bin_value(b)) + 1);
+        entry.store(index, memory_order_relaxed);
+    }
+    return uint8_t(index - 1);
+}
+
+void Term::palette_rgb(uint8_t index, uint8_t& r, uint8_t& g, uint8_t& b) {
+    if (index < 16) {
+        r = ansi_rgb[index][0];
+        g = ansi_rgb[index][1];
+        b = ansi_rgb[index][2];
+    } else if (index < 232) {
+        const unsigned i = index - 16u;
+        r = cube_level[i / 36];
+        g = cube_level[i / 6 % 6];
+        b = cube_level[i % 6];
+    } else {
+        r = g = b = uint8_t(8 + 10 * (index - 232));
+    }
+}
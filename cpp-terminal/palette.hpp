@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Term {
+
+/* Maps RGB colors to the nearest entry of the xterm palettes, for terminals
+ * which support only 256 or 16 colors. "Nearest" is by the distance in the
+ * CIELAB color space, i.e. as perceived rather than by the RGB values. The
+ * results are memoized in tables of 32 x 32 x 32 entries, so that a lookup
+ * costs a few nanoseconds once the color has been seen. The entries 0-15 of
+ * the 256-color palette are not used by rgb_to_256(), as terminals let
+ * users change them; the other entries map to themselves.
+ */
+
+// the entry 16-255 of the 256-color palette nearest to the color
+uint8_t rgb_to_256(uint8_t r, uint8_t g, uint8_t b);
+// the ANSI color 0-15 nearest to the color, as in xterm's defaults
+uint8_t rgb_to_16(uint8_t r, uint8_t g, uint8_t b);
+// the RGB values of an entry of the 256-color palette, as in xterm's
+// defaults for 0-15
+void palette_rgb(uint8_t index, uint8_t& r, uint8_t& g, uint8_t& b);
+
+}  // namespace Term
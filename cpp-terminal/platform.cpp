@@ -9,6 +9,9 @@
 #include <string>
 #include <chrono>
 #include <thread>
+#ifndef _WIN32
+#include <poll.h>
+#endif
 
 
 const bool Term::Private::debug = false;
@@ -31,11 +34,66 @@ bool Term::Private::is_stdout_a_tty() {
 #endif
 }
 
+size_t Term::Private::get_stdout_queued() {
+#ifdef _WIN32
+    return 0;
+#else
+    int n = 0;
+    if (ioctl(STDOUT_FILENO, TIOCOUTQ, &n) == -1 || n < 0) return 0;
+    return static_cast<size_t>(n);
+#endif
+}
+
+namespace {
+// characters put back by unread_raw()
+std::u32string unread;
+}
+
+void Term::Private::unread_raw(const std::u32string& s) {
+    unread.insert(0, s);
+}
+
+bool Term::Private::wait_raw(int timeout_ms) {
+    if (!unread.empty()) return true;
+    if (!Term::Private::BaseTerminal::is_instantiated ||
+        !Term::Private::BaseTerminal::raw_input) {
+        // read_raw() returns nothing
+        if (timeout_ms >= 0) {
+            this_thread::sleep_for(chrono::milliseconds(timeout_ms));
+        }
+        return false;
+    }
+#ifdef _WIN32
+    auto start = chrono::steady_clock::now();
+    while (!_kbhit()) {
+        if (timeout_ms >= 0 &&
+            chrono::steady_clock::now() - start >=
+                chrono::milliseconds(timeout_ms)) {
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return true;
+#else
+    pollfd p{STDIN_FILENO, POLLIN, 0};
+    int n = poll(&p, 1, timeout_ms);
+    if (n == -1 && errno != EINTR) {
+        throw std::runtime_error("poll() failed");
+    }
+    return n > 0;
+#endif
+}
+
 bool Term::Private::read_raw(char32_t* s) {
     if (!Term::Private::BaseTerminal::is_instantiated ||
         !Term::Private::BaseTerminal::raw_input) {
         return false;
     }
+    if (!unread.empty()) {
+        *s = unread[0];
+        unread.erase(0, 1);
+        return true;
+    }
 #ifdef _WIN32
     if (!_kbhit()) return false;
     int i = _getwch();
@@ -204,7 +262,8 @@ void Term::Private::SignalHandler(int signum) {
 
 Term::Private::BaseTerminal::BaseTerminal(bool a_clear_screen,
                                           bool a_raw_input,
-                                          bool a_disable_ctrl_c) {
+                                          bool a_disable_ctrl_c,
+                                          bool a_probe) {
     if (is_instantiated) {
         throw std::runtime_error("Only one instance of BaseTerminal allowed");
     }
@@ -300,6 +359,12 @@ Term::Private::BaseTerminal::BaseTerminal(bool a_clear_screen,
         // save screen
         std::cout << "\033[?1049h" << std::flush;
     }
+    try {
+        capabilities = detect_capabilities(raw_input && a_probe);
+    } catch (const std::runtime_error&) {
+        // the terminal is usable anyway
+        capabilities = assume_capabilities();
+    }
 }
 
 Term::Private::BaseTerminal::~BaseTerminal() noexcept(false) {
@@ -342,6 +407,7 @@ bool Term::Private::BaseTerminal::is_instantiated = false;
 bool Term::Private::BaseTerminal::clear_screen = false;
 bool Term::Private::BaseTerminal::raw_input = false;
 bool Term::Private::BaseTerminal::disable_ctrl_c = false;
+Term::Capabilities Term::Private::BaseTerminal::capabilities{};
 #ifdef _WIN32
 HANDLE Term::Private::BaseTerminal::hout(INVALID_HANDLE_VALUE);
 DWORD Term::Private::BaseTerminal::dwOriginalOutMode{};
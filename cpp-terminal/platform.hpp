@@ -13,7 +13,10 @@
 #include <csignal>
 #endif
 
+#include "capabilities.hpp"
+#include <cstddef>
 #include <stdexcept>
+#include <string>
 
 namespace Term::Private {
 extern const bool debug;
@@ -22,10 +25,18 @@ extern const bool debug;
 bool is_stdin_a_tty();
 // Returns true if the standard output is attached to a terminal
 bool is_stdout_a_tty();
+// Returns the number of bytes written to the standard output which the
+// terminal has not taken yet, 0 if unknown
+size_t get_stdout_queued();
 
 // Returns true if a character is read, otherwise immediately returns false
 // This can't be made inline
 bool read_raw(char32_t* s);
+// Puts characters back, to be returned by read_raw() before anything else
+void unread_raw(const std::u32string& s);
+// Waits up to timeout_ms milliseconds (-1: no limit) until read_raw() has
+// something to return, returns false on timeout
+bool wait_raw(int timeout_ms);
 
 // Restore the initial state of console input/output, in case the destructor
 // of BaseTerminal cannot be called.
@@ -45,6 +56,7 @@ void SignalHandler(int);
  */
 class BaseTerminal {
    friend bool read_raw(char32_t*);
+   friend bool wait_raw(int);
    friend void clean_up();
    private:
 #ifdef _WIN32
@@ -65,13 +77,17 @@ class BaseTerminal {
     static bool clear_screen;
     static bool raw_input;
     static bool disable_ctrl_c;
+    static Capabilities capabilities;
 
     bool get_term_size(size_t& cols, size_t& rows);
 
   public:
+    // probes the capabilities of the terminal if a_raw_input and
+    // a_probe, see detect_capabilities()
     explicit BaseTerminal(bool a_clear_screen = true,
                           bool a_raw_input = false,
-                          bool a_disable_ctrl_c = true);
+                          bool a_disable_ctrl_c = true,
+                          bool a_probe = true);
     BaseTerminal(const BaseTerminal&) = delete;
     BaseTerminal& operator=(const BaseTerminal&) = delete;
 
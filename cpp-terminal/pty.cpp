@@ -0,0 +1,526 @@
+#include "pty.hpp"
+#include "input.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#if defined(__APPLE__)
+#include <util.h>
+#elif defined(__FreeBSD__)
+#include <libutil.h>
+#else
+#include <pty.h>
+#endif
+
+extern char** environ;
+#endif
+
+using namespace std;
+
+#ifndef _WIN32
+namespace {
+// how long a program may take to exit after SIGHUP before it is killed
+const chrono::milliseconds hangup_grace(200);
+}  // namespace
+#endif
+
+/*******************
+ * Term::PtyWindow
+ *******************
+ */
+
+Term::PtyWindow::PtyWindow(Window* ptr, size_t off_x, size_t off_y,
+                           size_t w_, size_t h_, border_t b)
+    : ChildWindow(ptr, off_x, off_y, w_, h_, b)
+{
+    // the pty translates LF into CR LF where the program wants it to
+    ansi_lf_returns = false;
+}
+
+Term::PtyWindow::~PtyWindow() {
+#ifndef _WIN32
+    if (fd >= 0) ::close(fd);
+    if (pid > 0) {
+        ::kill(pid, SIGHUP);
+        int status = 0;
+        // give the program a moment to clean up
+        const auto deadline = chrono::steady_clock::now() + hangup_grace;
+        pid_t done = ::waitpid(pid, &status, WNOHANG);
+        while (done == 0 && chrono::steady_clock::now() < deadline) {
+            this_thread::sleep_for(chrono::milliseconds(5));
+            done = ::waitpid(pid, &status, WNOHANG);
+        }
+        if (done == 0) {
+            ::kill(pid, SIGKILL);
+            ::waitpid(pid, &status, 0);
+        }
+    }
+#endif
+}
+
+void Term::PtyWindow::spawn(const vector<string>& argv) {
+#ifdef _WIN32
+    throw runtime_error("spawn(): pseudo-terminals are not supported");
+#else
+    if (argv.empty()) throw runtime_error("spawn(): no program given");
+    if (fd >= 0) throw runtime_error("spawn(): a program is attached");
+    if (!w || !h) throw runtime_error("spawn(): the window has no size");
+    fix_size();
+    // Everything is prepared before forking, as the child may only call
+    // async-signal-safe functions until exec
+    vector<char*> args;
+    for (const string& arg : argv) {
+        args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+    vector<string> env_strings;
+    for (char** e = environ; *e; ++e) {
+        if (strncmp(*e, "TERM=", 5) != 0) env_strings.emplace_back(*e);
+    }
+    env_strings.emplace_back("TERM=xterm-256color");
+    vector<char*> env;
+    for (string& e : env_strings) env.push_back(&e[0]);
+    env.push_back(nullptr);
+
+    struct winsize ws{};
+    ws.ws_col = static_cast<unsigned short>(w);
+    ws.ws_row = static_cast<unsigned short>(h);
+    int master = -1;
+    pid_t child = ::forkpty(&master, nullptr, nullptr, &ws);
+    if (child < 0) {
+        throw runtime_error(string("spawn(): forkpty() failed: ") +
+                            strerror(errno));
+    }
+    if (child == 0) {
+        environ = env.data();
+        ::execvp(args[0], args.data());
+        _exit(127);
+    }
+    // not to be inherited by programs spawned later
+    ::fcntl(master, F_SETFD, FD_CLOEXEC);
+    ::fcntl(master, F_SETFL, ::fcntl(master, F_GETFL) | O_NONBLOCK);
+    fd = master;
+    pid = child;
+    exit_status = -1;
+    pending.clear();
+    reset_ansi();
+    reset_modes();
+    alternate = false;
+    main_grid.clear();
+    clear_grid();
+    show_cursor();
+#endif
+}
+
+int Term::PtyWindow::get_fd() const {
+    return fd;
+}
+
+bool Term::PtyWindow::is_running() {
+    if (pid < 0) return false;
+#ifndef _WIN32
+    int status = 0;
+    pid_t r = ::waitpid(pid, &status, WNOHANG);
+    if (r == 0) return true;
+    if (r == pid) {
+        if (WIFEXITED(status)) exit_status = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status)) exit_status = 128 + WTERMSIG(status);
+    }
+#endif
+    pid = -1;
+    return false;
+}
+
+int Term::PtyWindow::get_exit_status() const {
+    return exit_status;
+}
+
+size_t Term::PtyWindow::pump(size_t budget) {
+#ifdef _WIN32
+    return 0;
+#else
+    if (fd < 0) return 0;
+    flush_pending();
+    // the output is parsed right where read() puts it
+    static thread_local char buffer[1 << 14];
+    size_t total = 0;
+    while (total < budget) {
+        ssize_t r = ::read(fd, buffer, min(sizeof(buffer), budget - total));
+        if (r > 0) {
+            write_ansi(buffer, static_cast<size_t>(r));
+            total += static_cast<size_t>(r);
+            continue;
+        }
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        // end of file, or EIO on Linux: the program has closed its side
+        ::close(fd);
+        fd = -1;
+        pending.clear();
+        is_running();
+        break;
+    }
+    return total;
+#endif
+}
+
+size_t Term::PtyWindow::pump_all(const vector<PtyWindow*>& windows,
+                                 int timeout_ms, size_t budget) {
+#ifdef _WIN32
+    return 0;
+#else
+    static thread_local vector<pollfd> fds;
+    fds.clear();
+    for (const PtyWindow* win : windows) {
+        if (win->fd < 0) continue;
+        pollfd p{};
+        p.fd = win->fd;
+        p.events = POLLIN;
+        if (!win->pending.empty()) p.events |= POLLOUT;
+        fds.push_back(p);
+    }
+    if (fds.empty()) return 0;
+    if (::poll(fds.data(), fds.size(), timeout_ms) <= 0) return 0;
+    // every window gets its budget in turn
+    size_t total = 0;
+    size_t i = 0;
+    for (PtyWindow* win : windows) {
+        if (win->fd < 0) continue;
+        const short events = fds[i++].revents;
+        if (events & POLLOUT) win->flush_pending();
+        if (events & (POLLIN | POLLHUP | POLLERR)) total += win->pump(budget);
+    }
+    return total;
+#endif
+}
+
+void Term::PtyWindow::flush_pending() {
+#ifndef _WIN32
+    size_t done = 0;
+    while (done != pending.size() && fd >= 0) {
+        ssize_t r = ::write(fd, pending.data() + done, pending.size() - done);
+        if (r > 0) {
+            done += static_cast<size_t>(r);
+            continue;
+        }
+        if (r < 0 && errno == EINTR) continue;
+        // full: try again later. Other errors: pump() will notice.
+        break;
+    }
+    pending.erase(0, done);
+#endif
+}
+
+void Term::PtyWindow::send(const char* s, size_t n) {
+    if (fd < 0) return;
+    pending.append(s, n);
+    flush_pending();
+}
+
+void Term::PtyWindow::send(const string& s) {
+    send(s.data(), s.size());
+}
+
+void Term::PtyWindow::send_key(char32_t key) {
+    send(Private::encode_key(key, application_cursor));
+}
+
+void Term::PtyWindow::send_paste(const string& s) {
+    if (bracketed_paste) send("\x1b[200~");
+    send(s);
+    if (bracketed_paste) send("\x1b[201~");
+}
+
+void Term::PtyWindow::update_winsize() {
+#ifndef _WIN32
+    if (fd < 0) return;
+    struct winsize ws{};
+    ws.ws_col = static_cast<unsigned short>(w);
+    ws.ws_row = static_cast<unsigned short>(h);
+    ::ioctl(fd, TIOCSWINSZ, &ws);
+#endif
+}
+
+void Term::PtyWindow::set_w(size_t new_w) {
+    Window::set_w(new_w);
+    update_winsize();
+}
+
+void Term::PtyWindow::set_h(size_t new_h) {
+    Window::set_h(new_h);
+    // like xterm, forget the scroll region
+    region_top = 0;
+    region_bottom = SIZE_MAX;
+    update_winsize();
+}
+
+void Term::PtyWindow::resize(size_t new_w, size_t new_h) {
+    // a single SIGWINCH
+    Window::set_w(new_w);
+    Window::set_h(new_h);
+    region_top = 0;
+    region_bottom = SIZE_MAX;
+    update_winsize();
+}
+
+size_t Term::PtyWindow::get_region_bottom() const {
+    return min(region_bottom, h ? h - 1 : 0);
+}
+
+void Term::PtyWindow::save_cursor() {
+    saved_cursor = cursor;
+    saved_fg = ansi.sgr_fg;
+    saved_bg = ansi.sgr_bg;
+    saved_style = ansi.sgr_style;
+}
+
+void Term::PtyWindow::restore_cursor() {
+    cursor.x = min(saved_cursor.x, w ? w - 1 : 0);
+    cursor.y = min(saved_cursor.y, h ? h - 1 : 0);
+    ansi.sgr_fg = saved_fg;
+    ansi.sgr_bg = saved_bg;
+    ansi.sgr_style = saved_style;
+    ansi.wrap_pending = false;
+    ansi.cluster_len = 0;
+}
+
+void Term::PtyWindow::scroll_region(size_t top, size_t bottom, ptrdiff_t n) {
+    if (top > bottom || bottom >= h || bottom >= grid.size() || !n) return;
+    const size_t k = min(static_cast<size_t>(n < 0 ? -n : n),
+                         bottom - top + 1);
+    // only the rows move, not the cells
+    auto first = grid.begin() + top;
+    auto last = grid.begin() + bottom + 1;
+    if (n > 0) {
+        rotate(first, first + k, last);
+        for (size_t y = bottom + 1 - k; y <= bottom; ++y) clear_row(y);
+    } else {
+        rotate(first, last - k, last);
+        for (size_t y = top; y != top + k; ++y) clear_row(y);
+    }
+}
+
+void Term::PtyWindow::switch_screen(bool to_alternate) {
+    if (to_alternate == alternate) return;
+    if (to_alternate) {
+        main_grid = get_shared_grid();
+        grid.assign(h, SharedRow());
+    } else {
+        // the size may have changed in the meantime
+        main_grid.resize(h);
+        set_grid(main_grid);
+        main_grid.clear();
+    }
+    alternate = to_alternate;
+}
+
+void Term::PtyWindow::reset_modes() {
+    application_cursor = false;
+    bracketed_paste = false;
+    ansi_lf_returns = false;
+    region_top = 0;
+    region_bottom = SIZE_MAX;
+    saved_cursor = Cursor();
+    saved_fg = fg::unspecified;
+    saved_bg = bg::unspecified;
+    saved_style = style::unspecified;
+    ansi.sgr_fg = fg::unspecified;
+    ansi.sgr_bg = bg::unspecified;
+    ansi.sgr_style = style::unspecified;
+    show_cursor();
+}
+
+void Term::PtyWindow::ansi_newline() {
+    cursor.x = 0;
+    ansi.wrap_pending = false;
+    ansi.cluster_len = 0;
+    const size_t bottom = get_region_bottom();
+    if (cursor.y == bottom) scroll_region(region_top, bottom, 1);
+    else if (cursor.y + 1 < h) ++cursor.y;
+}
+
+void Term::PtyWindow::ansi_csi(char final_byte) {
+    const size_t count = min(size_t(ansi.param_count),
+                             size_t(AnsiState::MAX_PARAMS));
+    // parameter i, where 0 (or none) stands for the default value
+    auto param = [&](size_t i, size_t def) -> size_t {
+        return (i < count && ansi.params[i]) ? ansi.params[i] : def;
+    };
+    if (ansi.intermediate) {
+        // DECSTR, the soft reset
+        if (ansi.intermediate == '!' && final_byte == 'p') reset_modes();
+        return;
+    }
+    if (ansi.prefix == '?') {
+        if (final_byte != 'h' && final_byte != 'l') return;
+        const bool set = (final_byte == 'h');
+        for (size_t i = 0; i != count; ++i) {
+            switch (ansi.params[i]) {
+            case 1:
+                application_cursor = set;
+                break;
+            case 25:
+                if (set) show_cursor();
+                else hide_cursor();
+                break;
+            case 47:
+            case 1047:
+                switch_screen(set);
+                break;
+            case 1048:
+                if (set) save_cursor();
+                else restore_cursor();
+                break;
+            case 1049:
+                if (set) save_cursor();
+                switch_screen(set);
+                if (!set) restore_cursor();
+                break;
+            case 2004:
+                bracketed_paste = set;
+                break;
+            }
+        }
+        return;
+    }
+    if (ansi.prefix == '>' && final_byte == 'c') {
+        send("\x1b[>0;10;1c"); // secondary device attributes
+        return;
+    }
+    if (ansi.private_csi) return;
+    const size_t max_y = (h ? h - 1 : 0);
+    const size_t bottom = get_region_bottom();
+    const bool in_region = (cursor.y >= region_top && cursor.y <= bottom);
+    switch (final_byte) {
+    case 'c':
+        if (!param(0, 0)) send("\x1b[?1;2c"); // a VT100 with AVO
+        return;
+    case 'n':
+        if (param(0, 0) == 5) {
+            send("\x1b[0n");
+        } else if (param(0, 0) == 6) {
+            send("\x1b[" + to_string(cursor.y + 1) + ";" +
+                 to_string(cursor.x + 1) + "R");
+        }
+        return;
+    case 'd':
+        cursor.y = min(param(0, 1) - 1, max_y);
+        break;
+    case '`':
+        Window::ansi_csi('G');
+        return;
+    case 'E':
+        cursor.y = min(cursor.y + param(0, 1), max_y);
+        cursor.x = 0;
+        break;
+    case 'F':
+        cursor.y -= min(cursor.y, param(0, 1));
+        cursor.x = 0;
+        break;
+    case 'L':
+    case 'M':
+        if (!in_region) return;
+        scroll_region(cursor.y, bottom,
+                      (final_byte == 'M' ? 1 : -1) *
+                          static_cast<ptrdiff_t>(min(param(0, 1), h)));
+        cursor.x = 0;
+        break;
+    case 'S':
+    case 'T':
+        scroll_region(region_top, bottom,
+                      (final_byte == 'S' ? 1 : -1) *
+                          static_cast<ptrdiff_t>(min(param(0, 1), h)));
+        break;
+    case '@':
+    case 'P': {
+        if (cursor.x >= w || !find_row(cursor.y)) break;
+        vector<Cell>& row = access_row(cursor.y);
+        if (cursor.x >= row.size()) break;
+        const size_t n = min(param(0, 1), w - cursor.x);
+        if (final_byte == '@') {
+            row.insert(row.begin() + cursor.x, n, get_blank_cell());
+            if (row.size() > w) row.resize(w);
+        } else {
+            row.erase(row.begin() + cursor.x,
+                      row.begin() + cursor.x + min(n, row.size() - cursor.x));
+        }
+        break;
+    }
+    case 'X':
+        ansi_erase(cursor.y, cursor.x, cursor.x + param(0, 1));
+        break;
+    case 'r': {
+        const size_t top = param(0, 1) - 1;
+        const size_t bot = min(param(1, h), h) - 1;
+        if (top >= bot || bot >= h) return;
+        region_top = top;
+        region_bottom = (bot == max_y ? SIZE_MAX : bot);
+        cursor.x = 0;
+        cursor.y = 0;
+        break;
+    }
+    case 's':
+        save_cursor();
+        return;
+    case 'u':
+        restore_cursor();
+        return;
+    case 'h':
+    case 'l':
+        for (size_t i = 0; i != count; ++i) {
+            if (ansi.params[i] == 20) ansi_lf_returns = (final_byte == 'h');
+        }
+        return;
+    default:
+        Window::ansi_csi(final_byte);
+        return;
+    }
+    ansi.wrap_pending = false;
+    ansi.cluster_len = 0;
+}
+
+void Term::PtyWindow::ansi_esc(char final_byte) {
+    if (ansi.intermediate) return; // e.g. character sets
+    switch (final_byte) {
+    case '7':
+        save_cursor();
+        return;
+    case '8':
+        restore_cursor();
+        return;
+    case 'D': { // IND
+        size_t x = cursor.x;
+        ansi_newline();
+        cursor.x = x;
+        return;
+    }
+    case 'E': // NEL
+        ansi_newline();
+        return;
+    case 'M': // RI
+        ansi.wrap_pending = false;
+        ansi.cluster_len = 0;
+        if (cursor.y == region_top) {
+            scroll_region(region_top, get_region_bottom(), -1);
+        } else if (cursor.y) {
+            --cursor.y;
+        }
+        return;
+    case 'c': // RIS
+        reset_ansi();
+        reset_modes();
+        switch_screen(false);
+        clear_grid();
+        return;
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "window.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Term {
+
+/* A child window which runs a program on a pseudo-terminal, like a terminal
+ * emulator in a panel. The output of the program is read in bulk and fed
+ * through write_ansi(), which is extended here by what full-screen programs
+ * need: scroll regions, inserting and deleting lines and characters, the
+ * alternate screen, saving the cursor and answering cursor position
+ * requests. Keys from read_key() are passed on by send_key().
+ * Reading never blocks: pump() processes the output available, up to a
+ * budget per call, so that a busy program cannot starve the UI or other
+ * PtyWindows. pump_all() waits for any of several windows at once.
+ * Created by Window::new_child<PtyWindow>(). POSIX only: spawn() throws on
+ * Windows.
+ */
+class PtyWindow : public ChildWindow {
+    friend Window;
+
+   protected :
+    int fd{-1};           // the master side of the pty
+    int pid{-1};          // the child process, if not reaped yet
+    int exit_status{-1};
+    std::string pending;  // input the pty has not accepted yet
+
+    // modes set by the program
+    bool application_cursor{}; // DECCKM
+    bool bracketed_paste{};
+    // the scroll region: the rows [region_top, region_bottom]. The
+    // default region_bottom stands for the last row.
+    size_t region_top{};
+    size_t region_bottom{SIZE_MAX};
+    // DECSC/DECRC
+    Cursor saved_cursor;
+    FgColor saved_fg{fg::unspecified};
+    BgColor saved_bg{bg::unspecified};
+    style saved_style{style::unspecified};
+    // the main screen, while the alternate one is shown
+    bool alternate{};
+    std::vector<SharedRow> main_grid;
+
+    PtyWindow(Window* ptr, size_t off_x, size_t off_y,
+              size_t w_, size_t h_, border_t b = border_t::LINE);
+
+    size_t get_region_bottom() const;
+    void save_cursor();
+    void restore_cursor();
+    // moves the rows [top, bottom] up by n rows (or down, if n < 0),
+    // clearing the rows coming in
+    void scroll_region(size_t top, size_t bottom, ptrdiff_t n);
+    void switch_screen(bool to_alternate);
+    void reset_modes();
+    void update_winsize();
+    void flush_pending();
+
+    void ansi_newline() override;
+    void ansi_csi(char final_byte) override;
+    void ansi_esc(char final_byte) override;
+
+   public :
+    PtyWindow(const PtyWindow&) = delete;
+    PtyWindow& operator=(const PtyWindow&) = delete;
+    // Hangs up the pty and ends the program: it gets SIGHUP and 200 ms to
+    // exit, then SIGKILL
+    ~PtyWindow() override;
+
+    // Runs argv[0] (looked up in PATH) with the arguments argv on a new pty
+    // of the window's size, with TERM=xterm-256color. Throws if a program
+    // is still attached or the window has no size.
+    void spawn(const std::vector<std::string>& argv);
+    // the master side of the pty, e.g. for poll(). -1 if none.
+    int get_fd() const;
+    // false as soon as the program has exited (and has been reaped)
+    bool is_running();
+    // exit code, or 128 + signal number. -1 while running.
+    int get_exit_status() const;
+
+    // Processes the output available, at most budget bytes, without
+    // blocking. Returns the number of bytes processed. Closes the pty once
+    // the program has closed its side.
+    size_t pump(size_t budget = 1 << 16);
+    // Waits up to timeout_ms milliseconds (-1: indefinitely) until any of
+    // the windows has output, then pumps each window which has. Returns the
+    // number of bytes processed.
+    static size_t pump_all(const std::vector<PtyWindow*>&, int timeout_ms,
+                           size_t budget = 1 << 16);
+
+    // Sends input to the program. What the pty does not take at once is
+    // kept and sent by the next calls of send() and pump().
+    void send(const char* s, size_t n);
+    void send(const std::string&);
+    // sends a key as returned by read_key(), see Private::encode_key()
+    void send_key(char32_t);
+    // sends pasted text, enclosed in brackets if the program asked for it
+    void send_paste(const std::string&);
+
+    // also resize the pty, so that the program gets SIGWINCH
+    void set_w(size_t) override;
+    void set_h(size_t) override;
+    void resize(size_t, size_t) override;
+};
+
+}  // namespace Term
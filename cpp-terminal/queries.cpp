@@ -0,0 +1,299 @@
+#include "queries.hpp"
+#include "platform.hpp"
+#include "utf8.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace std;
+
+/*********************
+ * Term::QueryParser
+ *********************
+ */
+
+Term::QueryParser::~QueryParser() {
+    fail(pending.size(), "QueryParser: destroyed");
+}
+
+future<string> Term::QueryParser::add(Type type, string& request,
+                                      int param, clock::duration timeout) {
+    switch (type) {
+    case CURSOR_POSITION:
+        request.append("\x1b[6n");
+        break;
+    case STATUS:
+        request.append("\x1b[5n");
+        break;
+    case DEVICE_ATTRIBUTES:
+        request.append("\x1b[c");
+        break;
+    case SECONDARY_DA:
+        request.append("\x1b[>c");
+        break;
+    case VERSION:
+        request.append("\x1b[>0q");
+        break;
+    case MODE:
+        request.append("\x1b[?" + to_string(param) + "$p");
+        break;
+    case COLOR:
+        if (param >= 256) {
+            request.append("\x1b]4;" + to_string(param - 256) + ";?\x1b\\");
+        } else if (param >= 10 && param <= 12) {
+            request.append("\x1b]" + to_string(param) + ";?\x1b\\");
+        } else {
+            throw runtime_error("QueryParser::add(): no such color");
+        }
+        break;
+    case GRAPHIC_RENDITION:
+        request.append("\x1bP$qm\x1b\\");
+        break;
+    case KEYBOARD_FLAGS:
+        request.append("\x1b[?u");
+        break;
+    }
+    pending.push_back(Query{type, param, clock::now() + timeout, {}});
+    return pending.back().result.get_future();
+}
+
+void Term::QueryParser::fail(size_t n, const char* message) {
+    for (size_t k = 0; k != n; ++k) {
+        pending[k].result.set_exception(
+            make_exception_ptr(runtime_error(message)));
+    }
+    pending.erase(pending.begin(), pending.begin() + n);
+}
+
+size_t Term::QueryParser::sequence_end(const string& s, size_t i) {
+    const size_t n = s.size();
+    auto byte = [&](size_t j) {
+        return static_cast<unsigned char>(s[j]);
+    };
+    if (i + 1 == n) return 0;
+    const unsigned char kind = byte(i + 1);
+    if (kind == '[') {
+        for (size_t j = i + 2; j != n; ++j) {
+            if (byte(j) >= 0x40 && byte(j) <= 0x7e) return j + 1;
+        }
+        return 0;
+    }
+    if (kind == ']' || kind == 'P' || kind == '_' || kind == '^') {
+        // a string, up to ST or, for OSC, BEL
+        for (size_t j = i + 2; j != n; ++j) {
+            if (byte(j) == 0x07 && kind == ']') return j + 1;
+            if (byte(j) == 0x1b) {
+                if (j + 1 == n) return 0;
+                if (byte(j + 1) == '\\') return j + 2;
+            }
+        }
+        return 0;
+    }
+    if (kind == 'O') return i + 2 < n ? i + 3 : 0;
+    // a lone ESC key followed by a sequence, e.g. a response: the second
+    // ESC starts a sequence of its own
+    if (kind == 0x1b) return i + 1;
+    // Alt and a character, which may take several bytes
+    size_t len = 1;
+    if (kind >= 0xf0) len = 4;
+    else if (kind >= 0xe0) len = 3;
+    else if (kind >= 0xc0) len = 2;
+    return i + 1 + len <= n ? i + 1 + len : 0;
+}
+
+bool Term::QueryParser::match(const string& s, size_t i, size_t end) {
+    if (pending.empty()) return false;
+    Type type;
+    int param = 0;
+    string payload;
+    bool valid = true;
+    const char kind = s[i + 1];
+    if (kind == '[') {
+        const char final_byte = s[end - 1];
+        string body = s.substr(i + 2, end - i - 3);
+        char prefix = 0;
+        if (!body.empty() && body[0] >= 0x3c && body[0] <= 0x3f) {
+            prefix = body[0];
+            body.erase(0, 1);
+        }
+        if (final_byte == 'R' && !prefix) {
+            type = CURSOR_POSITION;
+            payload = body;
+        } else if (final_byte == 'n' && !prefix) {
+            type = STATUS;
+            payload = body;
+        } else if (final_byte == 'c' && prefix == '?') {
+            type = DEVICE_ATTRIBUTES;
+            payload = body;
+        } else if (final_byte == 'c' && prefix == '>') {
+            type = SECONDARY_DA;
+            payload = body;
+        } else if (final_byte == 'u' && prefix == '?') {
+            type = KEYBOARD_FLAGS;
+            payload = body;
+        } else if (final_byte == 'y' && prefix == '?' && !body.empty() &&
+                   body.back() == '$') {
+            // mode;value$
+            type = MODE;
+            const size_t semicolon = body.find(';');
+            if (semicolon == string::npos) return false;
+            param = atoi(body.c_str());
+            payload = body.substr(semicolon + 1,
+                                  body.size() - semicolon - 2);
+        } else {
+            return false;
+        }
+    } else if (kind == 'P' || kind == ']') {
+        // the string without the terminator
+        size_t stop = (s[end - 1] == 0x07) ? end - 1 : end - 2;
+        string body = s.substr(i + 2, stop - i - 2);
+        if (kind == 'P') {
+            if (body.compare(0, 2, ">|") == 0) {
+                type = VERSION;
+                payload = body.substr(2);
+            } else if (body.size() >= 3 && body.compare(1, 2, "$r") == 0) {
+                // "0$r" if the setting is not known
+                type = GRAPHIC_RENDITION;
+                valid = (body[0] == '1');
+                payload = body.substr(3);
+            } else {
+                return false;
+            }
+        } else {
+            type = COLOR;
+            size_t semicolon = body.find(';');
+            if (semicolon == string::npos) return false;
+            param = atoi(body.c_str());
+            if (param == 4) {
+                const size_t next = body.find(';', semicolon + 1);
+                if (next == string::npos) return false;
+                param = 256 + atoi(body.c_str() + semicolon + 1);
+                semicolon = next;
+            } else if (param < 10 || param > 12) {
+                return false;
+            }
+            payload = body.substr(semicolon + 1);
+        }
+    } else {
+        return false;
+    }
+    for (size_t k = 0; k != pending.size(); ++k) {
+        const Query& q = pending[k];
+        if (q.type != type) continue;
+        if ((type == MODE || type == COLOR) && q.param != param) continue;
+        // the queries before have been skipped by the terminal
+        fail(k, "QueryParser: not supported by the terminal");
+        if (valid) {
+            pending.front().result.set_value(payload);
+            pending.erase(pending.begin());
+        } else {
+            fail(1, "QueryParser: not supported by the terminal");
+        }
+        return true;
+    }
+    return false;
+}
+
+string Term::QueryParser::filter(const char* s, size_t n) {
+    if (pending.empty() && partial.empty()) return string(s, n);
+    // expire
+    const clock::time_point now = clock::now();
+    for (size_t k = 0; k != pending.size(); ) {
+        if (pending[k].deadline <= now) {
+            pending[k].result.set_exception(make_exception_ptr(
+                runtime_error("QueryParser: no response")));
+            pending.erase(pending.begin() + static_cast<ptrdiff_t>(k));
+        } else {
+            ++k;
+        }
+    }
+    string in;
+    swap(in, partial);
+    in.append(s, n);
+    string out;
+    size_t i = 0;
+    while (i < in.size()) {
+        if (in[i] != '\x1b') {
+            size_t j = in.find('\x1b', i);
+            if (j == string::npos) j = in.size();
+            out.append(in, i, j - i);
+            i = j;
+            continue;
+        }
+        const size_t end = sequence_end(in, i);
+        if (!end) {
+            // keys are passed on; a response is waited for
+            if (pending.empty()) out.append(in, i, string::npos);
+            else partial.assign(in, i, string::npos);
+            break;
+        }
+        if (!match(in, i, end)) out.append(in, i, end - i);
+        i = end;
+    }
+    return out;
+}
+
+string Term::QueryParser::filter(const string& s) {
+    return filter(s.data(), s.size());
+}
+
+bool Term::QueryParser::is_pending() const {
+    return !pending.empty();
+}
+
+int Term::QueryParser::get_timeout() const {
+    if (pending.empty()) return -1;
+    clock::time_point next = pending.front().deadline;
+    for (const Query& q : pending) next = min(next, q.deadline);
+    const clock::time_point now = clock::now();
+    if (next <= now) return 0;
+    return static_cast<int>(
+        chrono::ceil<chrono::milliseconds>(next - now).count());
+}
+
+size_t Term::QueryParser::get_memory_usage() const {
+    // a promise allocates its shared state: the control block and the
+    // result, a string
+    const size_t shared_state = 64 + sizeof(string);
+    // short strings are kept inside the object
+    const size_t heap = partial.capacity() > string().capacity()
+                            ? partial.capacity() + 1 : 0;
+    return sizeof(*this) + pending.capacity() * sizeof(Query) +
+           pending.size() * shared_state + heap;
+}
+
+void Term::parse_cursor_position(const string& s, size_t& col, size_t& row) {
+    const size_t semicolon = s.find(';');
+    if (semicolon == string::npos || semicolon == 0 ||
+        semicolon + 1 == s.size()) {
+        throw runtime_error("parse_cursor_position(): no position");
+    }
+    row = stoul(s.substr(0, semicolon)) - 1;
+    col = stoul(s.substr(semicolon + 1)) - 1;
+}
+
+void Term::Private::await_responses(QueryParser& parser) {
+    // the keys typed meanwhile are put back for read_key()
+    u32string keys;
+    string bytes;
+    char32_t c;
+    auto pass = [&]() {
+        const string rest = parser.filter(bytes);
+        utf8_decode(rest.data(), rest.size(), keys);
+        bytes.clear();
+    };
+    while (parser.is_pending()) {
+        Private::wait_raw(parser.get_timeout());
+        while (Private::read_raw(&c)) {
+            if (c > 0x10ffff) {
+                // a Key, not a character
+                pass();
+                keys.push_back(c);
+            } else {
+                utf8_encode(&c, 1, bytes);
+            }
+        }
+        pass();
+    }
+    Private::unread_raw(keys);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace Term {
+
+/* Sends queries to the terminal and picks the responses out of the input,
+ * passing everything else, i.e. the keys typed meanwhile, on in order.
+ * add() returns the request to write and a future, which gets the payload
+ * of the response (see Type), or a runtime_error if the terminal has not
+ * answered by the deadline. Terminals answer in order, so a response to a
+ * later query means that the earlier ones will not be answered: they fail
+ * at once. Sending DEVICE_ATTRIBUTES, which every terminal answers, after
+ * other queries thus makes them fail fast where they are not supported.
+ * The parser does not read by itself: the input is fed to filter(), which
+ * returns the rest. An escape sequence arriving in part is held back while
+ * queries are pending, so filter() is also to be called without input
+ * when get_timeout() elapses, to expire queries and release it.
+ * A response to DSR looks like a modified F3 key (CSI 1;2R); while the
+ * query is pending, it is taken as the response.
+ */
+class QueryParser {
+   public :
+    enum Type {
+        CURSOR_POSITION,   // DSR 6: "row;column", 1-based
+        STATUS,            // DSR 5: "0" if OK
+        DEVICE_ATTRIBUTES, // DA1: the parameters, e.g. "62;22"
+        SECONDARY_DA,      // DA2: the parameters, e.g. "41;354;0"
+        VERSION,           // XTVERSION: the text, e.g. "XTerm(354)"
+        MODE,              // DECRQM for the DEC private mode param: "0"
+                           // unknown, "1" set, "2" reset, "3" permanently
+                           // set, "4" permanently reset
+        COLOR,             // OSC 10/11/12 (param: foreground, background,
+                           // cursor) resp. OSC 4 for palette entry param-256
+                           // if param >= 256: e.g. "rgb:ffff/0000/0000"
+        GRAPHIC_RENDITION, // DECRQSS for SGR: the current attributes as
+                           // set, e.g. "0;38;2;1;2;3m"
+        KEYBOARD_FLAGS     // the kitty keyboard protocol flags, e.g. "0"
+    };
+    typedef std::chrono::steady_clock clock;
+
+   protected :
+    struct Query {
+        Type type;
+        int param;
+        clock::time_point deadline;
+        std::promise<std::string> result;
+    };
+
+    std::vector<Query> pending; // in the order sent
+    std::string partial;        // a sequence which may be a response
+
+    // the end of the escape sequence at s[i], 0 if incomplete
+    static size_t sequence_end(const std::string& s, size_t i);
+    // if s[i..end) is a response to a pending query, fulfills it
+    bool match(const std::string& s, size_t i, size_t end);
+    // fails the queries [0, n) with message
+    void fail(size_t n, const char* message);
+
+   public :
+    QueryParser() = default;
+    QueryParser(const QueryParser&) = delete;
+    QueryParser& operator=(const QueryParser&) = delete;
+    // the futures of the queries pending fail
+    ~QueryParser();
+
+    // Appends the request for the query to request, to be written to the
+    // terminal, and returns the future of the response.
+    std::future<std::string> add(Type, std::string& request,
+                                 int param = 0,
+                                 clock::duration timeout =
+                                     std::chrono::milliseconds(1000));
+    // Removes the responses from the input s[0..n) and returns the rest.
+    // Expires the queries past their deadline.
+    std::string filter(const char* s, size_t n);
+    std::string filter(const std::string& s);
+    bool is_pending() const;
+    // milliseconds until the next deadline, -1 if no query is pending
+    int get_timeout() const;
+    // the bytes of memory held, the object included (the shared state of
+    // a pending query's promise is estimated)
+    size_t get_memory_usage() const;
+};
+
+// Parses the payload of a CURSOR_POSITION response into 0-based values,
+// throws a runtime_error if it cannot be parsed
+void parse_cursor_position(const std::string&, size_t& col, size_t& row);
+
+namespace Private {
+// Reads the standard input until no query is pending. The keys typed
+// meanwhile are put back for read_key().
+void await_responses(QueryParser&);
+}  // namespace Private
+
+}  // namespace Term
@@ -0,0 +1,538 @@
+#include "renderer.hpp"
+#include "palette.hpp"
+#include "utf8.hpp"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Term::Cell;
+using Term::Window;
+
+// the escape sequence for a color, RGB colors mapped to the palette if the
+// terminal has fewer colors
+template <unsigned Colors>
+void append_color(const Term::FgColor& c, string& out) {
+    if (!c.is_rgb()) {
+        out.append(Term::color(c.get_fg()));
+    } else if constexpr (Colors >= (1u << 24)) {
+        out.append(Term::color24_fg(c.get_r(), c.get_g(), c.get_b()));
+    } else if constexpr (Colors >= 256) {
+        out.append("\033[38;5;");
+        out.append(to_string(
+            Term::rgb_to_256(c.get_r(), c.get_g(), c.get_b())));
+        out.push_back('m');
+    } else {
+        const unsigned i = Term::rgb_to_16(c.get_r(), c.get_g(), c.get_b());
+        out.append(Term::color(Term::fg(i < 8 ? 30 + i : 90 + i - 8)));
+    }
+}
+
+template <unsigned Colors>
+void append_color(const Term::BgColor& c, string& out) {
+    if (!c.is_rgb()) {
+        out.append(Term::color(c.get_bg()));
+    } else if constexpr (Colors >= (1u << 24)) {
+        out.append(Term::color24_bg(c.get_r(), c.get_g(), c.get_b()));
+    } else if constexpr (Colors >= 256) {
+        out.append("\033[48;5;");
+        out.append(to_string(
+            Term::rgb_to_256(c.get_r(), c.get_g(), c.get_b())));
+        out.push_back('m');
+    } else {
+        const unsigned i = Term::rgb_to_16(c.get_r(), c.get_g(), c.get_b());
+        out.append(Term::color(Term::bg(i < 8 ? 40 + i : 100 + i - 8)));
+    }
+}
+
+// Resolved: the window resolves the defaults on writing, so no attributes
+// are unspecified
+template <class Policy, bool Resolved>
+void encode_run(const Window& win,
+                size_t y,
+                size_t x_begin,
+                size_t x_end,
+                const Cell& defaults,
+                Cell& current,
+                string& out) {
+    const size_t width = win.get_w();
+    // the text between two escape sequences is encoded at once
+    static thread_local u32string text;
+    text.clear();
+    auto flush_text = [&]() {
+        Term::utf8_encode(text.data(), text.size(), out);
+        text.clear();
+    };
+    // the character written last, if it may be repeated, and how often it
+    // is still to be written
+    char32_t last = 0;
+    size_t repeats = 0;
+    auto flush_repeats = [&]() {
+        if (!repeats) return;
+        const string rep = "\033[" + to_string(repeats) + 'b';
+        if (rep.size() < repeats * Term::utf8_length(&last, 1)) {
+            flush_text();
+            out.append(rep);
+        } else {
+            text.append(repeats, last);
+        }
+        repeats = 0;
+    };
+    // if the previous cell holds a wide grapheme covering this one
+    bool covered = false;
+    for (size_t i = x_begin; i < x_end; i++) {
+        bool update_fg = false;
+        bool update_bg = false;
+        bool update_style = false;
+        Cell cell = win.get_cell(i, y);
+        if (cell.is_wide_tail()) {
+            if (covered) {
+                covered = false;
+                continue;
+            }
+            // the wide grapheme has been overwritten
+            cell.set_char(U' ');
+        }
+        covered = false;
+        if (cell.is_empty()) {
+            cell.set_char(U' ');
+        } else if (cell.get_width() == 2) {
+            // displayed only if the right half is still reserved for it
+            // and inside the window, otherwise columns would shift
+            if (i + 1 < width && win.get_cell(i + 1, y).is_wide_tail())
+                covered = true;
+            else
+                cell.set_char(U' ');
+        }
+        if constexpr (!Resolved) {
+            if (cell.cell_fg.is_unspecified()) {
+                cell.cell_fg = defaults.cell_fg;
+            }
+            if (cell.cell_bg.is_unspecified()) {
+                cell.cell_bg = defaults.cell_bg;
+            }
+            if (cell.cell_style == Term::style::unspecified) {
+                cell.cell_style = defaults.cell_style;
+            }
+        }
+        if (current.cell_fg != cell.cell_fg) {
+            current.cell_fg = cell.cell_fg;
+            update_fg = true;
+        }
+        if (current.cell_bg != cell.cell_bg) {
+            current.cell_bg = cell.cell_bg;
+            update_bg = true;
+        }
+        if (current.cell_style != cell.cell_style) {
+            current.cell_style = cell.cell_style;
+            update_style = true;
+            if (current.cell_style == Term::style::reset) {
+                // style::reset resets fg and bg colors too, we have to
+                // set them again if they are non-default, but if fg or
+                // bg colors are reset, we do not update them, as
+                // style::reset already did that.
+                update_fg = !current.cell_fg.is_reset();
+                update_bg = !current.cell_bg.is_reset();
+            }
+        }
+        if (update_style || update_fg || update_bg) {
+            if constexpr (Policy::repeat) {
+                flush_repeats();
+                last = 0;
+            }
+            flush_text();
+        }
+        // Set style first, as style::reset will reset colors too
+        if (update_style) out.append(Term::color(cell.cell_style));
+        if (update_fg) append_color<Policy::colors>(cell.cell_fg, out);
+        if (update_bg) append_color<Policy::colors>(cell.cell_bg, out);
+        if constexpr (Policy::repeat) {
+            // a run of the same narrow character is written once
+            if (cell.grapheme == last) {
+                ++repeats;
+                continue;
+            }
+            flush_repeats();
+            const char32_t c = cell.grapheme;
+            last = (c >= 0x20 && c != 0x7f && c < Cell::WIDE_TAIL &&
+                    !covered) ? c : 0;
+        }
+        cell.append_grapheme(text);
+    }
+    if constexpr (Policy::repeat) flush_repeats();
+    flush_text();
+}
+
+template <class Policy>
+void encode_cells(const Window& win,
+                  size_t y,
+                  size_t x_begin,
+                  size_t x_end,
+                  const Cell& defaults,
+                  Cell& current,
+                  string& out) {
+    if (win.is_resolving_defaults()) {
+        encode_run<Policy, true>(win, y, x_begin, x_end, defaults, current,
+                                 out);
+    } else {
+        encode_run<Policy, false>(win, y, x_begin, x_end, defaults, current,
+                                  out);
+    }
+}
+
+template <class Policy>
+string render_window(const Window& win,
+                     size_t w,
+                     size_t h,
+                     size_t x0,
+                     size_t y0,
+                     size_t width,
+                     size_t height,
+                     const char* newline) {
+    using namespace Term;
+    if (!width) width = w;
+    if (!height) height = h;
+    // inside win?
+    if (x0 >= win.get_w() || y0 >= win.get_h()) return string();
+    // adjust the cut-out to fit both win and console window
+    width = std::min({width, w, win.get_w() - x0});
+    height = std::min({height, h, win.get_h() - y0});
+    string out;
+    // the terminal shows the frame once it is complete
+    if constexpr (Policy::synchronized_output) out.append("\033[?2026h");
+    out.append(Term::cursor_off() + Term::clear_screen_buffer() +
+               Term::move_cursor(0, 0));
+    // compose only the visible cut-out
+    Window merged_win = win.merge_children(x0, y0, width, height);
+    const Cell defaults(U' ', win.get_default_fg(), win.get_default_bg(),
+                        win.get_default_style());
+    // the attributes the console is set to
+    Cell current(U' ', fg::reset, bg::reset, style::reset);
+    for (size_t j = 0; j < height; j++) {
+        if (j) {
+            if constexpr (Policy::reset_bg_at_eol) {
+                // Resetting background color at the end of each line
+                // is a workaround for the bug in Visual Studio Code
+                // (https://github.com/jupyter-xeus/cpp-terminal/issues/95)
+                if (!current.cell_bg.is_reset()) {
+                    out.append(color(bg::reset));
+                    current.cell_bg = bg::reset;
+                }
+            }
+            out.append(newline);
+        }
+        encode_cells<Policy>(merged_win, j, 0, width, defaults, current,
+                             out);
+    }
+    // reset colors and style at the end
+    if (!current.cell_fg.is_reset()) out.append(color(fg::reset));
+    if (!current.cell_bg.is_reset()) out.append(color(bg::reset));
+    if (current.cell_style != style::reset) out.append(color(style::reset));
+    // place cursor
+    // (the cursor of the merged cut-out is relative to (x0, y0) already)
+    Cursor cur = merged_win.get_cursor();
+    if (cur.is_visible && cur.x < width && cur.y < height) {
+        out.append(Term::move_cursor(cur.x, cur.y));
+        out.append(cursor_on());
+    }
+    if constexpr (Policy::synchronized_output) out.append("\033[?2026l");
+    return out;
+}
+
+template <class Policy>
+void render_diff(const Window& cur,
+                 const Window* prev,
+                 const Cell& defaults,
+                 size_t width,
+                 size_t height,
+                 string& out) {
+    using namespace Term;
+    const bool full = !prev;
+    if constexpr (Policy::synchronized_output) out.append("\033[?2026h");
+    out.append(cursor_off());
+    if (full) out.append(clear_screen_buffer());
+    Cell current(U' ', fg::reset, bg::reset, style::reset);
+    const vector<SharedRow> rows = cur.get_shared_grid();
+    vector<SharedRow> old_rows;
+    if (!full) old_rows = prev->get_shared_grid();
+    // what get_cell() returns for a cell not stored
+    const Cell missing(U' ', cur.get_default_fg(), cur.get_default_bg(),
+                       cur.get_default_style());
+    for (size_t y = 0; y < height; ++y) {
+        size_t first = 0;
+        size_t end = width;
+        if (!full) {
+            const vector<Cell>* a = rows[y].get();
+            const vector<Cell>* b = old_rows[y].get();
+            // a shared row has not changed
+            if (a == b) continue;
+            auto cell = [&](const vector<Cell>* row,
+                            size_t x) -> const Cell& {
+                return (row && x < row->size()) ? (*row)[x] : missing;
+            };
+            while (first < width && cell(a, first) == cell(b, first)) ++first;
+            if (first == width) continue;
+            size_t last = width - 1;
+            while (cell(a, last) == cell(b, last)) --last;
+            // redraw wide graphemes as a whole, old ones as well as new ones
+            while (first &&
+                   (cell(a, first).is_wide_tail() ||
+                    cell(b, first).is_wide_tail())) {
+                --first;
+            }
+            while (last + 1 < width &&
+                   (cell(a, last + 1).is_wide_tail() ||
+                    cell(b, last + 1).is_wide_tail())) {
+                ++last;
+            }
+            end = last + 1;
+        }
+        out.append(move_cursor(first, y));
+        encode_cells<Policy>(cur, y, first, end, defaults, current, out);
+    }
+    // reset colors and style at the end
+    if (!current.cell_fg.is_reset()) out.append(color(fg::reset));
+    if (!current.cell_bg.is_reset()) out.append(color(bg::reset));
+    if (current.cell_style != style::reset) out.append(color(style::reset));
+    // place cursor
+    Cursor cursor = cur.get_cursor();
+    if (cursor.is_visible && cursor.x < width && cursor.y < height) {
+        out.append(move_cursor(cursor.x, cursor.y));
+        out.append(cursor_on());
+    }
+    if constexpr (Policy::synchronized_output) out.append("\033[?2026l");
+}
+
+template <class Policy>
+const Term::Private::Encoder& encoder() {
+    static const Term::Private::Encoder e{
+        &encode_cells<Policy>, &render_window<Policy>, &render_diff<Policy>};
+    return e;
+}
+
+// picks the instantiation one feature after the other
+template <unsigned Colors, bool Sync, bool ResetBg>
+const Term::Private::Encoder& select(bool repeat) {
+    using Term::Private::RenderPolicy;
+    return repeat ? encoder<RenderPolicy<Colors, Sync, ResetBg, true>>()
+                  : encoder<RenderPolicy<Colors, Sync, ResetBg, false>>();
+}
+
+template <unsigned Colors, bool Sync>
+const Term::Private::Encoder& select(bool reset_bg_at_eol, bool repeat) {
+    return reset_bg_at_eol ? select<Colors, Sync, true>(repeat)
+                           : select<Colors, Sync, false>(repeat);
+}
+
+template <unsigned Colors>
+const Term::Private::Encoder& select(bool synchronized_output,
+                                     bool reset_bg_at_eol,
+                                     bool repeat) {
+    return synchronized_output
+               ? select<Colors, true>(reset_bg_at_eol, repeat)
+               : select<Colors, false>(reset_bg_at_eol, repeat);
+}
+
+}  // namespace
+
+const Term::Private::Encoder& Term::Private::get_encoder(
+    unsigned colors,
+    bool synchronized_output,
+    bool reset_bg_at_eol,
+    bool repeat) {
+    if (colors >= (1u << 24)) {
+        return select<1u << 24>(synchronized_output, reset_bg_at_eol, repeat);
+    }
+    if (colors >= 256) {
+        return select<256>(synchronized_output, reset_bg_at_eol, repeat);
+    }
+    return select<16>(synchronized_output, reset_bg_at_eol, repeat);
+}
+
+const Term::Private::Encoder& Term::Private::get_encoder(
+    const Capabilities& c, unsigned colors) {
+    return get_encoder(colors, c.synchronized_output, c.reset_bg_at_eol,
+                       c.repeat);
+}
+
+void Term::Private::encode_cells(const Window& win,
+                                 size_t y,
+                                 size_t x_begin,
+                                 size_t x_end,
+                                 const Cell& defaults,
+                                 Cell& current,
+                                 string& out,
+                                 unsigned colors) {
+    get_encoder(colors).encode_cells(win, y, x_begin, x_end, defaults,
+                                     current, out);
+}
+
+string Term::Private::render_window(const Window& win,
+                                    size_t w,
+                                    size_t h,
+                                    size_t x0,
+                                    size_t y0,
+                                    size_t width,
+                                    size_t height,
+                                    const char* newline,
+                                    unsigned colors) {
+    return get_encoder(colors).render_window(win, w, h, x0, y0, width,
+                                             height, newline);
+}
+
+void Term::Private::render_diff(const Window& cur,
+                                const Window* prev,
+                                const Cell& defaults,
+                                size_t width,
+                                size_t height,
+                                string& out,
+                                unsigned colors) {
+    get_encoder(colors).render_diff(cur, prev, defaults, width, height, out);
+}
+
+/***********************
+ * Term::AsyncRenderer
+ ***********************
+ */
+
+Term::AsyncRenderer::AsyncRenderer(Terminal& terminal)
+    : term(terminal)
+    , term_w(terminal.get_w())
+    , term_h(terminal.get_h())
+{
+    thread = std::thread(&AsyncRenderer::run, this);
+}
+
+Term::AsyncRenderer::~AsyncRenderer() {
+    {
+        lock_guard<std::mutex> lock(frame_mutex);
+        stopping = true;
+    }
+    frame_ready.notify_one();
+    thread.join();
+}
+
+void Term::AsyncRenderer::rethrow_error() {
+    if (!error) return;
+    exception_ptr e = error;
+    error = nullptr;
+    rethrow_exception(e);
+}
+
+void Term::AsyncRenderer::publish(const Window& win,
+                                  size_t x0,
+                                  size_t y0,
+                                  size_t width,
+                                  size_t height) {
+    const size_t w = term_w.load(memory_order_relaxed);
+    const size_t h = term_h.load(memory_order_relaxed);
+    if (!width) width = w;
+    if (!height) height = h;
+    // inside win?
+    if (x0 >= win.get_w() || y0 >= win.get_h()) return;
+    // adjust the cut-out to fit both win and console window
+    width = std::min({width, w, win.get_w() - x0});
+    height = std::min({height, h, win.get_h() - y0});
+    Frame frame;
+    frame.win.reset(new Window(win.merge_children(x0, y0, width, height)));
+    frame.defaults = Cell(U' ', win.get_default_fg(), win.get_default_bg(),
+                          win.get_default_style());
+    frame.encoder = &term.get_encoder();
+    vector<Frame> done;
+    {
+        lock_guard<std::mutex> lock(frame_mutex);
+        swap(done, retired);
+        rethrow_error();
+        if (back.win) ++dropped;
+        swap(back, frame);
+    }
+    frame_ready.notify_one();
+    // the frames done with and a frame dropped are released here, outside
+    // the lock
+}
+
+void Term::AsyncRenderer::invalidate() {
+    lock_guard<std::mutex> lock(frame_mutex);
+    full_redraw = true;
+}
+
+void Term::AsyncRenderer::wait() {
+    unique_lock<std::mutex> lock(frame_mutex);
+    frame_done.wait(lock, [&]() {
+        return (!back.win && !rendering) || error;
+    });
+    rethrow_error();
+}
+
+size_t Term::AsyncRenderer::get_rendered_count() {
+    lock_guard<std::mutex> lock(frame_mutex);
+    return rendered;
+}
+
+size_t Term::AsyncRenderer::get_dropped_count() {
+    lock_guard<std::mutex> lock(frame_mutex);
+    return dropped;
+}
+
+size_t Term::AsyncRenderer::get_term_w() const {
+    return term_w.load(memory_order_relaxed);
+}
+
+size_t Term::AsyncRenderer::get_term_h() const {
+    return term_h.load(memory_order_relaxed);
+}
+
+void Term::AsyncRenderer::run() {
+    unique_lock<std::mutex> lock(frame_mutex);
+    for (;;) {
+        frame_ready.wait(lock, [&]() { return back.win || stopping; });
+        // a frame still waiting is rendered before stopping
+        if (!back.win) break;
+        swap(front, back);
+        const bool full = full_redraw;
+        full_redraw = false;
+        rendering = true;
+        lock.unlock();
+        exception_ptr e;
+        try {
+            render(full);
+        } catch (...) {
+            e = current_exception();
+        }
+        lock.lock();
+        // see retired
+        if (front.win) retired.push_back(move(front));
+        rendering = false;
+        if (e) {
+            error = e;
+            full_redraw = true;
+        } else {
+            ++rendered;
+        }
+        frame_done.notify_all();
+    }
+}
+
+void Term::AsyncRenderer::render(bool full) {
+    if (term.update_size()) full = true;
+    term_w.store(term.get_w(), memory_order_relaxed);
+    term_h.store(term.get_h(), memory_order_relaxed);
+    const Window& cur = *front.win;
+    const Window* prev = shown.win.get();
+    if (!prev || prev->get_w() != cur.get_w() ||
+        prev->get_h() != cur.get_h() || shown.defaults != front.defaults ||
+        shown.encoder != front.encoder) {
+        full = true;
+    }
+    // the frame may have been composed for a larger terminal
+    const size_t width = min(cur.get_w(), term.get_w());
+    const size_t height = min(cur.get_h(), term.get_h());
+    out.clear();
+    front.encoder->render_diff(cur, full ? nullptr : prev, front.defaults,
+                               width, height, out);
+    cout << out << flush;
+    swap(shown, front);
+}
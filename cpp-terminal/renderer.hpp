@@ -0,0 +1,167 @@
+#pragma once
+
+#include "base.hpp"
+#include "window.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Term {
+
+namespace Private {
+/* The features of the terminal the encoder makes use of. They are fixed
+ * per terminal, so they are template parameters rather than tested for
+ * each cell: get_encoder() selects the instantiation once.
+ */
+template <unsigned Colors, bool Sync, bool ResetBg, bool Repeat>
+struct RenderPolicy {
+    // 16, 256 or 1 << 24: RGB colors are mapped to the palette if fewer
+    static constexpr unsigned colors = Colors;
+    // frames are enclosed in DEC private mode 2026, so the terminal shows
+    // them once they are complete
+    static constexpr bool synchronized_output = Sync;
+    // render_window() resets the background before each newline, for VS
+    // Code, which fills line ends with it
+    static constexpr bool reset_bg_at_eol = ResetBg;
+    // runs of a character are written by REP (CSI n b) where shorter
+    static constexpr bool repeat = Repeat;
+};
+
+// the renderers below, instantiated for a policy
+struct Encoder {
+    void (*encode_cells)(const Window&, size_t y, size_t x_begin,
+                         size_t x_end, const Cell& defaults, Cell& current,
+                         std::string& out);
+    std::string (*render_window)(const Window&, size_t w, size_t h,
+                                 size_t x0, size_t y0, size_t width,
+                                 size_t height, const char* newline);
+    void (*render_diff)(const Window& cur, const Window* prev,
+                        const Cell& defaults, size_t width, size_t height,
+                        std::string& out);
+};
+const Encoder& get_encoder(unsigned colors,
+                           bool synchronized_output = false,
+                           bool reset_bg_at_eol = true,
+                           bool repeat = false);
+// for the capabilities of a terminal, with colors as it is set to
+const Encoder& get_encoder(const Capabilities&, unsigned colors);
+
+// The functions below use the encoder for colors and the defaults of the
+// other features.
+
+// Appends the cells [x_begin, x_end) of row y of win to out, as text and
+// the escape sequences for the attributes. current holds the attributes
+// the terminal is set to and is updated, unspecified ones are taken from
+// defaults. A wide grapheme is printed only if its right half is part of
+// win, too; x_begin must not be the right half of a wide grapheme. RGB
+// colors are mapped to the palette if the terminal has fewer colors (see
+// Capabilities::colors).
+void encode_cells(const Window& win, size_t y, size_t x_begin, size_t x_end,
+                  const Cell& defaults, Cell& current, std::string& out,
+                  unsigned colors = 1u << 24);
+// The output of Terminal::draw_window() for a terminal of w x h cells.
+// Rows are separated by newline, "\r\n" where the output is not a tty
+// translating "\n".
+std::string render_window(const Window&, size_t w, size_t h,
+                          size_t x0 = 0,
+                          size_t y0 = 0,
+                          size_t width = std::string::npos,
+                          size_t height = std::string::npos,
+                          const char* newline = "\n",
+                          unsigned colors = 1u << 24);
+// Appends what turns the terminal showing prev into showing the cells
+// [0, width) x [0, height) of cur: only the cells which differ, and rows
+// shared by both (see SharedRow) are skipped without comparing them.
+// prev has to have the size and defaults of cur; nullptr: everything is
+// drawn. Rows are addressed by cursor movements, not "\n".
+void render_diff(const Window& cur, const Window* prev, const Cell& defaults,
+                 size_t width, size_t height, std::string& out,
+                 unsigned colors = 1u << 24);
+} // namespace Term::Private
+
+/* Draws windows on the terminal from a thread of its own, so that the
+ * application never waits for the terminal, e.g. on a slow ssh link.
+ * publish() composes the window (see Window::merge_children()) into a
+ * frame and hands it over to the render thread, which writes only the
+ * cells that differ from the frame shown before. Rows shared with that
+ * frame (see SharedRow) are skipped without looking at their cells. If
+ * the render thread is still busy, the new frame replaces the one waiting,
+ * if any: the terminal always gets the latest state, and frames nobody
+ * would see are dropped.
+ * While an AsyncRenderer exists, it owns the terminal output: do not call
+ * Terminal::draw_window() or print to cout in the meantime.
+ */
+class AsyncRenderer {
+   protected :
+    struct Frame {
+        std::unique_ptr<Window> win; // the composed cut-out
+        Cell defaults;               // the attributes of win for unspecified
+        // Terminal::get_encoder() at publish()
+        const Private::Encoder* encoder{};
+    };
+
+    Terminal& term;
+    std::mutex frame_mutex;
+    std::condition_variable frame_ready; // for the render thread
+    std::condition_variable frame_done;  // for wait()
+    // guarded by frame_mutex
+    Frame back;                   // published, not rendered yet
+    bool full_redraw{true};
+    bool stopping{};
+    bool rendering{};
+    std::exception_ptr error;
+    size_t dropped{};
+    size_t rendered{};
+    // Frames done with, released by publish(). The rows of a frame are
+    // shared with the published window, and SharedRow::modify() writes in
+    // place once it sees the last other reference gone, so the references
+    // have to be dropped by the publishing thread.
+    std::vector<Frame> retired;
+    // render thread only
+    Frame front;                  // being rendered
+    Frame shown;                  // what the terminal shows
+    std::string out;
+    // the terminal size as last seen by the render thread
+    std::atomic<size_t> term_w{}, term_h{};
+    std::thread thread;
+
+    void run();
+    void render(bool full);
+    // with frame_mutex locked
+    void rethrow_error();
+
+   public :
+    // starts the render thread
+    explicit AsyncRenderer(Terminal&);
+    AsyncRenderer(const AsyncRenderer&) = delete;
+    AsyncRenderer& operator=(const AsyncRenderer&) = delete;
+    // renders the frame still waiting, if any, and stops the thread
+    ~AsyncRenderer();
+
+    // Like Terminal::draw_window(), but returns as soon as the frame is
+    // composed. Rethrows an exception thrown in the render thread.
+    void publish(const Window&,
+                 size_t x0 = 0,
+                 size_t y0 = 0,
+                 size_t width = std::string::npos,
+                 size_t height = std::string::npos);
+    // the next frame is drawn completely, e.g. after other output
+    void invalidate();
+    // blocks until the frame published last is on the terminal
+    void wait();
+
+    size_t get_rendered_count(); // frames written to the terminal
+    size_t get_dropped_count();  // frames replaced before being rendered
+    // the terminal size, to be used instead of Terminal::get_w() and
+    // get_h() while the render thread may update it
+    size_t get_term_w() const;
+    size_t get_term_h() const;
+};
+
+}  // namespace Term
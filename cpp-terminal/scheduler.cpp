@@ -0,0 +1,147 @@
+#include "scheduler.hpp"
+#include "platform.hpp"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+/************************
+ * Term::FrameScheduler
+ ************************
+ */
+
+Term::FrameScheduler::FrameScheduler(Terminal& terminal,
+                                     const Window& window,
+                                     double max_fps)
+    : term(terminal)
+    , win(window)
+{
+    set_max_fps(max_fps);
+}
+
+void Term::FrameScheduler::set_max_fps(double fps) {
+    if (!(fps > 0)) {
+        throw runtime_error("FrameScheduler::set_max_fps(): not positive");
+    }
+    interval = chrono::duration_cast<clock::duration>(
+        chrono::duration<double>(1 / fps));
+}
+
+double Term::FrameScheduler::get_max_fps() const {
+    return 1 / chrono::duration<double>(interval).count();
+}
+
+void Term::FrameScheduler::set_output(NonBlockingOutput* out) {
+    output = out;
+}
+
+void Term::FrameScheduler::request() {
+    ++requests;
+    pending = true;
+}
+
+void Term::FrameScheduler::request_echo() {
+    request();
+    echo = true;
+}
+
+void Term::FrameScheduler::measure(clock::time_point now,
+                                   size_t queued_now) {
+    if (queued_now >= queued) {
+        // nothing drained, or output written by someone else
+        queued = queued_now;
+        written = now;
+        return;
+    }
+    const double seconds = chrono::duration<double>(now - written).count();
+    if (seconds > 0) {
+        const double rate = (queued - queued_now) / seconds;
+        if (queued_now) {
+            // the terminal has been draining all the time
+            throughput = throughput ? 0.75 * throughput + 0.25 * rate : rate;
+        } else if (throughput && rate > throughput) {
+            // drained earlier: the rate is a lower bound only
+            throughput = rate;
+        }
+    }
+    queued = queued_now;
+    written = now;
+}
+
+void Term::FrameScheduler::draw(clock::time_point now) {
+    pending = false;
+    echo = false;
+    backlog = false;
+    term.update_size();
+    const string out = term.render_window(win);
+    const clock::time_point start = clock::now();
+    if (output) {
+        output->begin_frame();
+        output->write(out);
+    } else {
+        cout << out << std::flush;
+    }
+    written = clock::now();
+    queued = Private::get_stdout_queued();
+    // A write which took that long has waited for the terminal to make
+    // room, all the bytes not queued now have been drained meanwhile
+    const double seconds = chrono::duration<double>(written - start).count();
+    if (seconds > 0.001 && out.size() > queued) {
+        const double rate = (out.size() - queued) / seconds;
+        throughput = throughput ? 0.75 * throughput + 0.25 * rate : rate;
+    }
+    due = now + interval;
+    ++frames;
+}
+
+bool Term::FrameScheduler::update() {
+    if (output) output->flush();
+    if (!pending) return false;
+    const clock::time_point now = clock::now();
+    // with an output, the stale rest of a frame gives way to the echo
+    const bool urgent = echo && output;
+    if (!urgent && (!echo || backlog) && now < due) return false;
+    const size_t queued_now = Private::get_stdout_queued();
+    measure(now, queued_now);
+    const size_t backlog_now =
+        queued_now + (output ? output->get_pending() : 0);
+    if (backlog_now && !urgent) {
+        // the terminal is still busy, try again once it should be done
+        clock::duration wait = interval;
+        if (throughput) {
+            wait = chrono::duration_cast<clock::duration>(
+                chrono::duration<double>(backlog_now / throughput));
+        }
+        due = now + std::max<clock::duration>(wait, chrono::milliseconds(1));
+        backlog = true;
+        return false;
+    }
+    draw(now);
+    return true;
+}
+
+void Term::FrameScheduler::flush() {
+    if (pending) draw(clock::now());
+}
+
+int Term::FrameScheduler::get_timeout() const {
+    if (!pending) return -1;
+    if (echo && (!backlog || output)) return 0;
+    const clock::time_point now = clock::now();
+    if (due <= now) return 0;
+    return static_cast<int>(
+        chrono::ceil<chrono::milliseconds>(due - now).count());
+}
+
+double Term::FrameScheduler::get_throughput() const {
+    return throughput;
+}
+
+size_t Term::FrameScheduler::get_frame_count() const {
+    return frames;
+}
+
+size_t Term::FrameScheduler::get_request_count() const {
+    return requests;
+}
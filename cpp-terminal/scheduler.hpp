@@ -0,0 +1,84 @@
+#pragma once
+
+#include "base.hpp"
+#include "output.hpp"
+#include "window.hpp"
+#include <chrono>
+#include <cstddef>
+
+namespace Term {
+
+/* Decides when a window is drawn, so that the application may request a
+ * redraw after every change without flooding the terminal. Requests are
+ * coalesced: update() draws the window at most once per interval of the
+ * frame rate set, with the state it has by then, and not at all if
+ * nothing was requested. A frame is also held back while the terminal has
+ * not taken the previous one yet (see Private::get_stdout_queued()), so on
+ * a slow link the frame rate follows the rate the terminal drains, which
+ * is measured as a side effect.
+ * Redraws for echoing input skip the frame rate, to keep typing
+ * responsive, but not the backpressure: a frame queued behind a backlog
+ * would only show later than the newest state drawn once it is gone.
+ * With a NonBlockingOutput (see set_output()) drawing never blocks, and
+ * echo frames skip the backpressure, too: the stale remainder of the
+ * previous frame is abandoned instead.
+ * update() is meant to be called from the event loop, which waits no
+ * longer than get_timeout() for input, e.g. by PtyWindow::pump_all().
+ */
+class FrameScheduler {
+   protected :
+    typedef std::chrono::steady_clock clock;
+
+    Terminal& term;
+    const Window& win;
+    NonBlockingOutput* output{};
+    clock::duration interval; // 1 / the frame rate
+    bool pending{};           // a redraw was requested
+    bool echo{};              // ... to echo input
+    bool backlog{};           // due is held back for the terminal
+    clock::time_point due;    // when the next frame may be drawn
+    // the last frame
+    clock::time_point written;
+    size_t queued{};          // bytes the terminal had not taken after it
+    double throughput{};      // bytes/s the terminal takes, 0 if unknown
+    size_t frames{};
+    size_t requests{};
+
+    // updates throughput from the queue, queued_now bytes at now
+    void measure(clock::time_point now, size_t queued_now);
+    void draw(clock::time_point now);
+
+   public :
+    FrameScheduler(Terminal&, const Window&, double max_fps = 60);
+    FrameScheduler(const FrameScheduler&) = delete;
+    FrameScheduler& operator=(const FrameScheduler&) = delete;
+
+    void set_max_fps(double);
+    double get_max_fps() const;
+
+    // writes the frames to output rather than to cout, nullptr: to cout.
+    // update() flushes it, too.
+    void set_output(NonBlockingOutput*);
+
+    // requests a redraw, e.g. after a change of the window
+    void request();
+    // requests a redraw which echoes input, drawn by the next update()
+    // unless the terminal is still busy
+    void request_echo();
+    // draws the window if a redraw is requested and due, returns true if
+    // it has
+    bool update();
+    // draws the window now if a redraw is requested, e.g. before exiting
+    void flush();
+    // milliseconds until update() is to be called, -1 if no redraw is
+    // requested
+    int get_timeout() const;
+
+    // bytes per second the terminal takes as measured, 0 if the terminal
+    // has never been busy long enough to tell
+    double get_throughput() const;
+    size_t get_frame_count() const;   // frames drawn
+    size_t get_request_count() const; // requests, coalesced into frames
+};
+
+}  // namespace Term
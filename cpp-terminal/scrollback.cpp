@@ -0,0 +1,236 @@
+#include "scrollback.hpp"
+#include "grapheme.hpp"
+#include "utf8.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+/**************************
+ * Term::ScrollbackWindow
+ **************************
+ */
+
+Term::ScrollbackWindow::ScrollbackWindow(size_t width, size_t height,
+                                         size_t capacity)
+    : Window(width, height)
+    , lines(max(capacity, height))
+{
+    if (lines.empty())
+        throw runtime_error("ScrollbackWindow(): capacity must not be 0");
+    hide_cursor();
+}
+
+vector<Term::Cell>& Term::ScrollbackWindow::push_line() {
+    if (count == lines.size()) {
+        // recycle the oldest line
+        first = ring_index(1);
+        --count;
+        if (top) --top;
+    }
+    SharedRow& row = lines[ring_index(count)];
+    // clear() keeps the allocated memory for reuse, unless the line is
+    // still shared with a snapshot
+    row.clear();
+    ++count;
+    return row.modify();
+}
+
+const vector<Term::Cell>* Term::ScrollbackWindow::find_row(size_t y) const {
+    const SharedRow* row = find_shared_row(y);
+    return row ? row->get() : nullptr;
+}
+
+const Term::SharedRow* Term::ScrollbackWindow::find_shared_row(
+    size_t y) const {
+    if (y >= h || top + y >= count) return nullptr;
+    return &lines[ring_index(top + y)];
+}
+
+vector<Term::Cell>& Term::ScrollbackWindow::access_row(size_t y) {
+    // writing below the last line extends the log. As h <= capacity, the
+    // loop terminates even if old lines have to be recycled meanwhile.
+    while (top + y >= count) {
+        push_line();
+    }
+    return lines[ring_index(top + y)].modify();
+}
+
+void Term::ScrollbackWindow::scroll_rows(size_t n) {
+    // push_line() keeps top pointing to the same line when recycling
+    top += n;
+    while (top + h > count) {
+        push_line();
+    }
+}
+
+size_t Term::ScrollbackWindow::get_capacity() const {
+    return lines.size();
+}
+
+void Term::ScrollbackWindow::set_capacity(size_t new_capacity) {
+    new_capacity = max(new_capacity, h);
+    if (!new_capacity)
+        throw runtime_error("set_capacity(): capacity must not be 0");
+    if (new_capacity == lines.size()) return;
+    bool bottom = is_at_bottom();
+    size_t keep = min(count, new_capacity);
+    size_t dropped = count - keep;
+    vector<SharedRow> new_lines(new_capacity);
+    for (size_t i = 0; i != keep; ++i) {
+        swap(new_lines[i], lines[ring_index(dropped + i)]);
+    }
+    lines.swap(new_lines);
+    first = 0;
+    count = keep;
+    top = (top > dropped ? top - dropped : 0);
+    if (bottom) scroll_to_bottom();
+    else scroll_to(top);
+}
+
+size_t Term::ScrollbackWindow::get_line_count() const {
+    return count;
+}
+
+size_t Term::ScrollbackWindow::append_line(const u32string& s,
+                                           FgColor a_fg,
+                                           BgColor a_bg,
+                                           style a_style) {
+    if (a_fg == fg::unspecified)
+        a_fg = default_fg;
+    if (a_bg == bg::unspecified)
+        a_bg = default_bg;
+    if (a_style == style::unspecified)
+        a_style = default_style;
+    bool bottom = is_at_bottom();
+    vector<Cell>* row = &push_line();
+    size_t appended = 1;
+    size_t sz = 0;
+    for (size_t i = 0; i != s.size(); i += sz) {
+        sz = grapheme_length(s.data() + i, s.size() - i);
+        if (s[i] == Key::CR || s[i] == Key::LF) {
+            // treat CR LF as a single line break
+            if (s[i] == Key::CR && i + 1 != s.size() && s[i + 1] == Key::LF)
+                ++sz;
+            row = &push_line();
+            ++appended;
+            continue;
+        }
+        size_t blanks = 0;
+        size_t cells = 1;
+        if (s[i] == Key::TAB) {
+            if (!tabsize) continue;
+            blanks = tabsize - (row->size() % tabsize);
+        } else if (s[i] < U' ' || s[i] > UTF8_MAX) {
+            continue;
+        } else if (w > 1) {
+            cells = grapheme_width(s.data() + i, sz);
+        }
+        if (row->size() + cells > w) {
+            // wrap long lines
+            row = &push_line();
+            ++appended;
+        }
+        if (blanks) {
+            blanks = min(blanks, w - row->size());
+            row->resize(row->size() + blanks,
+                        Cell(U' ', a_fg, a_bg, a_style));
+            continue;
+        }
+        // normalize to composed, just like Window::set_grapheme()
+        row->emplace_back(U'\0', a_fg, a_bg, a_style);
+        row->back().set_grapheme(to_nfc(s.substr(i, sz)));
+        if (cells == 2)
+            row->emplace_back(Cell::WIDE_TAIL, a_fg, a_bg, a_style);
+    }
+    if (bottom) scroll_to_bottom();
+    return appended;
+}
+
+size_t Term::ScrollbackWindow::append_line(const string& s,
+                                           FgColor a_fg,
+                                           BgColor a_bg,
+                                           style a_style) {
+    return append_line(utf8_decode(s), a_fg, a_bg, a_style);
+}
+
+void Term::ScrollbackWindow::drop_lines(size_t n) {
+    n = min(n, count);
+    first = ring_index(n);
+    count -= n;
+    // keep showing the same lines if possible
+    top = (top > n ? top - n : 0);
+}
+
+size_t Term::ScrollbackWindow::get_top() const {
+    return top;
+}
+
+void Term::ScrollbackWindow::scroll_to(size_t line) {
+    size_t max_top = (count > h ? count - h : 0);
+    top = min(line, max_top);
+}
+
+void Term::ScrollbackWindow::scroll_up(size_t n) {
+    scroll_to(top > n ? top - n : 0);
+}
+
+void Term::ScrollbackWindow::scroll_down(size_t n) {
+    scroll_to(top + n);
+}
+
+void Term::ScrollbackWindow::scroll_to_bottom() {
+    scroll_to(count);
+}
+
+bool Term::ScrollbackWindow::is_at_bottom() const {
+    return top + h >= count;
+}
+
+void Term::ScrollbackWindow::set_w(size_t new_w) {
+    Window::set_w(new_w);
+    for (size_t i = 0; i != count; ++i) {
+        SharedRow& row = lines[ring_index(i)];
+        if (row.size() > w)
+            row.modify().resize(w);
+    }
+}
+
+void Term::ScrollbackWindow::set_h(size_t new_h) {
+    bool bottom = is_at_bottom();
+    if (new_h > lines.size()) set_capacity(new_h);
+    Window::set_h(new_h);
+    if (bottom) scroll_to_bottom();
+    else scroll_to(top);
+}
+
+void Term::ScrollbackWindow::set_grid(const vector<SharedRow>& new_grid) {
+    size_t n = new_grid.size();
+    if (n > h) {
+        if (height_fixed) n = h;
+        else set_h(n);
+    }
+    for (size_t y = 0; y != n; ++y) {
+        if (new_grid[y].size() > w && !width_fixed)
+            set_w(new_grid[y].size());
+    }
+    for (size_t y = 0; y != h; ++y) {
+        if (y < n) {
+            // writing below the last line extends the log
+            while (top + y >= count) push_line();
+            SharedRow& row = lines[ring_index(top + y)];
+            row = new_grid[y];
+            if (row.size() > w) row.modify().resize(w);
+        } else if (top + y < count) {
+            lines[ring_index(top + y)].clear();
+        }
+    }
+    if (resolving_defaults) resolve_stored_cells();
+}
+
+void Term::ScrollbackWindow::clear_grid() {
+    Window::clear_grid();
+    first = 0;
+    count = 0;
+    top = 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "window.hpp"
+#include <string>
+#include <vector>
+
+namespace Term {
+
+/* A window showing a viewport into a log of lines. The lines are kept in a
+ * ring buffer of fixed capacity, so that appending a line, scrolling and
+ * dropping old lines is O(1) regardless of the length of the log. Once the
+ * capacity is reached, appending a line recycles the oldest one.
+ * The window rows 0..h-1 show the lines get_top()..get_top()+h-1. All
+ * methods inherited from Window (set_grapheme(), write(), draw_window() and
+ * child windows etc.) operate on these visible lines.
+ */
+class ScrollbackWindow : public Window {
+   protected :
+    std::vector<SharedRow> lines;         // the ring buffer
+    size_t first{};                       // ring index of the oldest line
+    size_t count{};                       // number of lines in use
+    size_t top{};                         // line shown in window row 0
+
+    size_t ring_index(size_t line) const {
+        return (first + line) % lines.size();
+    }
+    // appends an empty line, recycling the oldest one if necessary
+    std::vector<Cell>& push_line();
+
+    const std::vector<Cell>* find_row(size_t y) const override;
+    std::vector<Cell>& access_row(size_t y) override;
+    const SharedRow* find_shared_row(size_t y) const override;
+    // appends lines, so that the rows scrolled out remain in the log
+    void scroll_rows(size_t n) override;
+
+   public :
+    // capacity is raised to height if smaller
+    ScrollbackWindow(size_t width, size_t height, size_t capacity);
+
+    size_t get_capacity() const;
+    // Keeps the newest lines if the new capacity is less than
+    // get_line_count(). This is the only operation that is O(capacity).
+    void set_capacity(size_t);
+
+    size_t get_line_count() const;
+
+    // Appends the string as new line(s) at the end of the log. Lines longer
+    // than w are wrapped, CR and LF start a new line. If the viewport was
+    // at the bottom, it follows the new lines. Returns the number of lines
+    // appended.
+    size_t append_line(const std::u32string&,
+                       FgColor = fg::unspecified,
+                       BgColor = bg::unspecified,
+                       style = style::unspecified);
+    size_t append_line(const std::string&,
+                       FgColor = fg::unspecified,
+                       BgColor = bg::unspecified,
+                       style = style::unspecified);
+
+    // drops the oldest n lines
+    void drop_lines(size_t n = 1);
+
+    size_t get_top() const; // the line shown in window row 0
+    // keeps the viewport inside the log, i.e. top <= get_line_count() - h
+    void scroll_to(size_t line);
+    void scroll_up(size_t n = 1);
+    void scroll_down(size_t n = 1);
+    void scroll_to_bottom();
+    bool is_at_bottom() const;
+
+    void set_w(size_t) override;
+    // the capacity grows with h if necessary
+    void set_h(size_t) override;
+    // drops all lines
+    void clear_grid() override;
+    // the rows replace the lines in view
+    using Window::set_grid;
+    void set_grid(const std::vector<SharedRow>&) override;
+};
+
+}  // namespace Term
@@ -0,0 +1,249 @@
+#include "session.hpp"
+#include "input.hpp"
+#include "renderer.hpp"
+#include "utf8.hpp"
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+using namespace std;
+
+/*****************
+ * Term::Session
+ *****************
+ */
+
+Term::Session::Session(int in, int out, unsigned opts)
+    : in_fd(in)
+    , options(opts)
+    , encoder(&Private::get_encoder(colors))
+    , output(out)
+{
+#ifndef _WIN32
+    if ((options & RAW_INPUT) && ::isatty(in_fd)) {
+        if (::tcgetattr(in_fd, &orig_termios) == -1) {
+            throw runtime_error("Session: tcgetattr() failed");
+        }
+        // the same mode as Terminal sets
+        struct termios raw = orig_termios;
+        raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+        raw.c_cflag |= (CS8);
+        raw.c_lflag &= ~(ECHO | ICANON | IEXTEN);
+        if (options & DISABLE_CTRL_C) raw.c_lflag &= ~(ISIG);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        if (::tcsetattr(in_fd, TCSAFLUSH, &raw) == -1) {
+            throw runtime_error("Session: tcsetattr() failed");
+        }
+        termios_set = true;
+    }
+    in_flags = ::fcntl(in_fd, F_GETFL);
+    if (in_flags == -1 ||
+        ::fcntl(in_fd, F_SETFL, in_flags | O_NONBLOCK) == -1) {
+        const int e = errno;
+        if (termios_set) ::tcsetattr(in_fd, TCSAFLUSH, &orig_termios);
+        throw runtime_error(string("Session: fcntl() failed: ") +
+                            strerror(e));
+    }
+#endif
+    update_size();
+    if (options & CLEAR_SCREEN) {
+        // save the cursor position and the screen
+        output.write("\x1b""7\x1b[?1049h");
+    }
+}
+
+Term::Session::~Session() {
+    try {
+        if (options & CLEAR_SCREEN) {
+            output.begin_frame();
+            output.write("\x1b[?1049l\x1b""8");
+        }
+    } catch (...) {
+        // the peer has gone
+    }
+    // a server must not hang on a peer which does not read
+    output.discard();
+#ifndef _WIN32
+    if (termios_set) ::tcsetattr(in_fd, TCSAFLUSH, &orig_termios);
+    ::fcntl(in_fd, F_SETFL, in_flags);
+#endif
+}
+
+int Term::Session::get_in_fd() const {
+    return in_fd;
+}
+
+int Term::Session::get_out_fd() const {
+    return output.get_fd();
+}
+
+bool Term::Session::update_size() {
+#ifndef _WIN32
+    struct winsize ws {};
+    if (::ioctl(output.get_fd(), TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        // not a terminal: set_size() tells
+        return false;
+    }
+    const size_t old_w = w, old_h = h;
+    w = ws.ws_col;
+    h = ws.ws_row;
+    return (old_w != w || old_h != h);
+#else
+    return false;
+#endif
+}
+
+void Term::Session::set_size(size_t w_, size_t h_) {
+    w = w_;
+    h = h_;
+}
+
+size_t Term::Session::get_w() const {
+    return w;
+}
+
+size_t Term::Session::get_h() const {
+    return h;
+}
+
+void Term::Session::set_colors(unsigned c) {
+    colors = c;
+    encoder = &Private::get_encoder(colors);
+}
+
+unsigned Term::Session::get_colors() const {
+    return colors;
+}
+
+const Term::Private::Encoder& Term::Session::get_encoder() const {
+    return *encoder;
+}
+
+size_t Term::Session::read_input() {
+    if (closed) return 0;
+#ifndef _WIN32
+    char buffer[4096];
+    for (;;) {
+        ssize_t r = ::read(in_fd, buffer, sizeof(buffer));
+        if (r > 0) {
+            input += queries.filter(buffer, static_cast<size_t>(r));
+            return static_cast<size_t>(r);
+        }
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // expires queries
+            input += queries.filter(buffer, 0);
+            return 0;
+        }
+        // the end, or e.g. EIO from a pty whose other side has gone
+        closed = true;
+        return 0;
+    }
+#else
+    return 0;
+#endif
+}
+
+bool Term::Session::is_closed() const {
+    return closed;
+}
+
+future<string> Term::Session::query(QueryParser::Type type, int param,
+                                    QueryParser::clock::duration timeout) {
+    string request;
+    future<string> response = queries.add(type, request, param, timeout);
+    output.write(request);
+    return response;
+}
+
+int Term::Session::get_timeout() const {
+    return queries.get_timeout();
+}
+
+size_t Term::Session::key_length() const {
+    const size_t n = input.size();
+    auto byte = [&](size_t i) {
+        return static_cast<unsigned char>(input[i]);
+    };
+    // the length of the UTF-8 sequence at i, 0 if incomplete
+    auto char_length = [&](size_t i) -> size_t {
+        const unsigned char c = byte(i);
+        size_t len = 1;
+        if (c >= 0xf0) len = 4;
+        else if (c >= 0xe0) len = 3;
+        else if (c >= 0xc0) len = 2;
+        size_t end = i + 1;
+        while (end != n && end - i < len && (byte(end) & 0xc0) == 0x80)
+            ++end;
+        // a sequence cut short by an invalid byte is complete, too
+        if (end - i < len && end == n) return 0;
+        return end - i;
+    };
+    if (byte(0) != 0x1b) return char_length(0);
+    // a lone ESC is the escape key, as for read_key0()
+    if (n == 1) return 1;
+    if (byte(1) != '[' && byte(1) != 'O') {
+        const size_t len = char_length(1);
+        return len ? 1 + len : 0;
+    }
+    for (size_t i = 2; i != n; ++i) {
+        if (byte(i) >= 0x40) return i + 1;
+    }
+    return 0;
+}
+
+char32_t Term::Session::read_key0() {
+    if (input.empty()) return 0;
+    const size_t len = key_length();
+    if (!len) return 0;
+    char32_t key = Key::UNKNOWN;
+    if (utf8_validate(input.data(), len)) {
+        u32string seq;
+        utf8_decode(input.data(), len, seq);
+        key = Private::decode_sequence(seq);
+    }
+    input.erase(0, len);
+    // an idle session holds no memory
+    if (input.empty()) string().swap(input);
+    return key;
+}
+
+void Term::Session::draw_window(const Window& win,
+                                size_t x0,
+                                size_t y0,
+                                size_t width,
+                                size_t height) {
+    update_size();
+    output.begin_frame();
+    // the output may be a socket, which does not translate "\n"
+    output.write(encoder->render_window(win, w, h, x0, y0, width, height,
+                                        "\r\n"));
+}
+
+void Term::Session::write(const string& s) {
+    output.write(s);
+}
+
+size_t Term::Session::flush() {
+    return output.flush();
+}
+
+bool Term::Session::is_pending() const {
+    return output.is_pending();
+}
+
+size_t Term::Session::get_memory_usage() const {
+    // short strings are kept inside the object
+    const size_t heap = input.capacity() > string().capacity()
+                            ? input.capacity() + 1 : 0;
+    return sizeof(*this) - sizeof(output) - sizeof(queries) +
+           output.get_memory_usage() + queries.get_memory_usage() + heap;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "base.hpp"
+#include "output.hpp"
+#include "queries.hpp"
+#include "window.hpp"
+#include <cstddef>
+#include <future>
+#include <string>
+
+namespace Term {
+
+/* A terminal on arbitrary file descriptors, e.g. a pty or a socket accepted
+ * by a server, so that one process can drive many terminals from a single
+ * event loop. Terminal stands for the console of the process and exists
+ * once; any number of Sessions may exist, each with all its state its own.
+ * Nothing blocks: the descriptors are switched to non-blocking mode. The
+ * event loop polls get_in_fd() for input and then calls read_input() and
+ * read_key0() until it returns 0, and polls get_out_fd() for POLLOUT while
+ * is_pending() and then calls flush() (see NonBlockingOutput).
+ * The size is read from out_fd if that is a terminal; otherwise, e.g. for
+ * a socket, it has to be set by set_size(). A Session holds no buffers
+ * while idle, see get_memory_usage(). Writing to a peer which has gone
+ * throws; like any server, the application should ignore SIGPIPE. POSIX
+ * only: the constructor throws on Windows.
+ */
+class Session {
+   protected :
+    int in_fd;
+    unsigned options;
+    size_t w{}, h{};
+    unsigned colors{1u << 24};
+    const Private::Encoder* encoder;
+    bool closed{};
+    std::string input;          // bytes read, not decoded yet
+    NonBlockingOutput output;
+    QueryParser queries;
+    int in_flags{-1};           // to be restored
+#ifndef _WIN32
+    bool termios_set{};
+    struct termios orig_termios{};
+#endif
+
+    // the number of bytes the key at the start of input takes, 0 if the
+    // key is incomplete
+    size_t key_length() const;
+
+   public :
+    // options: CLEAR_SCREEN and RAW_INPUT as for Terminal, the latter
+    // only if in_fd is a terminal. in_fd and out_fd may be the same.
+    Session(int in_fd, int out_fd, unsigned options = CLEAR_SCREEN);
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+    // restores the terminal as far as it takes the output at once; the
+    // rest is dropped
+    ~Session();
+
+    int get_in_fd() const;
+    int get_out_fd() const;
+
+    // reads out_fd's size if it is a terminal, returns true if changed
+    bool update_size();
+    void set_size(size_t w, size_t h);
+    size_t get_w() const;
+    size_t get_h() const;
+    // as Terminal::set_colors(), truecolor by default
+    void set_colors(unsigned);
+    unsigned get_colors() const;
+    // the renderers selected for the colors, see Private::RenderPolicy
+    const Private::Encoder& get_encoder() const;
+
+    // Reads the input available, returns how many bytes. Returns 0 and
+    // sets is_closed() at the end of the input or on an error. Responses
+    // to queries are taken out of the input.
+    size_t read_input();
+    // Like Term::read_key0(), for the input read. An escape sequence
+    // which has arrived in part is kept until the rest arrives.
+    char32_t read_key0();
+    bool is_closed() const;
+
+    // Sends a query to the terminal, see QueryParser. The event loop has to
+    // call read_input() when get_timeout() elapses, even without input.
+    std::future<std::string> query(QueryParser::Type,
+                                   int param = 0,
+                                   QueryParser::clock::duration timeout =
+                                       std::chrono::milliseconds(1000));
+    // milliseconds until a query expires, -1 if none is pending
+    int get_timeout() const;
+
+    // like Terminal::draw_window(), abandoning the rest of the previous
+    // frame if the terminal has not taken it yet
+    void draw_window(const Window&,
+                     size_t x0 = 0,
+                     size_t y0 = 0,
+                     size_t width = std::string::npos,
+                     size_t height = std::string::npos);
+    // writes s as it is, after what is pending
+    void write(const std::string& s);
+    size_t flush();
+    bool is_pending() const;
+
+    // the bytes of memory held by the session, the object included
+    size_t get_memory_usage() const;
+};
+
+}  // namespace Term
@@ -0,0 +1,311 @@
+#include "text_view.hpp"
+#include "grapheme.hpp"
+#include "utf8.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+/************************
+ * Term::TextViewWindow
+ ************************
+ */
+
+Term::TextViewWindow::TextViewWindow(size_t width, size_t height)
+    : Window(width, height)
+    , view(height)
+{
+    hide_cursor();
+}
+
+const vector<pair<size_t, size_t>>&
+Term::TextViewWindow::layout(size_t p) const {
+    const Paragraph& par = paragraphs[p];
+    if (par.stable_lo <= w && w < par.stable_hi &&
+        par.layout_tabsize == tabsize) {
+        // the line breaks do not change at this width
+        return par.lines;
+    }
+    pair<size_t, size_t> stable;
+    wrap_lines(par.text, 0, par.lines, &stable);
+    par.stable_lo = stable.first;
+    par.stable_hi = stable.second;
+    par.layout_tabsize = tabsize;
+    ++layout_count;
+    return par.lines;
+}
+
+size_t Term::TextViewWindow::line_of(size_t p, size_t offset) const {
+    const vector<pair<size_t, size_t>>& lines = layout(p);
+    auto it = upper_bound(lines.begin(), lines.end(), offset,
+                          [](size_t off, const pair<size_t, size_t>& line) {
+                              return off < line.first;
+                          });
+    return it == lines.begin() ? 0 : it - lines.begin() - 1;
+}
+
+void Term::TextViewWindow::render_line(const Paragraph& par,
+                                       size_t begin, size_t end,
+                                       vector<Cell>& row) const {
+    row.clear();
+    const u32string& s = par.text;
+    // the run in effect at begin
+    size_t next_run = upper_bound(par.runs.begin(), par.runs.end(), begin,
+                                  [](size_t off, const TextRun& run) {
+                                      return off < run.offset;
+                                  }) - par.runs.begin();
+    FgColor a_fg = default_fg;
+    BgColor a_bg = default_bg;
+    style a_style = default_style;
+    auto apply = [&](const TextRun& run) {
+        a_fg = (run.fg == fg::unspecified ? default_fg : run.fg);
+        a_bg = (run.bg == bg::unspecified ? default_bg : run.bg);
+        a_style = (run.st == style::unspecified ? default_style : run.st);
+    };
+    if (next_run) apply(par.runs[next_run - 1]);
+    size_t sz = 0;
+    for (size_t i = begin; i < end && row.size() < w; i += sz) {
+        sz = grapheme_length(s.data() + i, end - i);
+        while (next_run != par.runs.size() && par.runs[next_run].offset <= i)
+            apply(par.runs[next_run++]);
+        if (s[i] == Key::TAB) {
+            if (!tabsize) continue;
+            size_t blanks = tabsize - (row.size() % tabsize);
+            row.resize(min(w, row.size() + blanks),
+                       Cell(U' ', a_fg, a_bg, a_style));
+            continue;
+        }
+        if (s[i] < U' ' || s[i] > UTF8_MAX) continue;
+        size_t cells = (w > 1 ? grapheme_width(s.data() + i, sz) : 1);
+        if (row.size() + cells > w) break;
+        // normalize to composed, just like Window::set_grapheme()
+        row.emplace_back(U'\0', a_fg, a_bg, a_style);
+        row.back().set_grapheme(to_nfc(s.substr(i, sz)));
+        if (cells == 2)
+            row.emplace_back(Cell::WIDE_TAIL, a_fg, a_bg, a_style);
+    }
+}
+
+void Term::TextViewWindow::refresh_view() const {
+    if (!view_dirty) return;
+    view.resize(h);
+    size_t p = top_paragraph;
+    size_t l = (p < paragraphs.size() ? line_of(p, top_offset) : 0);
+    for (size_t y = 0; y != h; ++y) {
+        if (p == paragraphs.size()) {
+            view[y].clear();
+            continue;
+        }
+        const vector<pair<size_t, size_t>>& lines = layout(p);
+        render_line(paragraphs[p], lines[l].first, lines[l].second, view[y]);
+        if (++l == lines.size()) {
+            ++p;
+            l = 0;
+        }
+    }
+    view_dirty = false;
+}
+
+const vector<Term::Cell>* Term::TextViewWindow::find_row(size_t y) const {
+    if (y >= h) return nullptr;
+    refresh_view();
+    return &view[y];
+}
+
+vector<Term::Cell>& Term::TextViewWindow::access_row(size_t y) {
+    refresh_view();
+    return view[y];
+}
+
+size_t Term::TextViewWindow::get_paragraph_count() const {
+    return paragraphs.size();
+}
+
+const u32string& Term::TextViewWindow::get_paragraph(size_t index) const {
+    if (index >= paragraphs.size())
+        throw runtime_error("get_paragraph(): index out of bounds");
+    return paragraphs[index].text;
+}
+
+const vector<Term::TextRun>&
+Term::TextViewWindow::get_runs(size_t index) const {
+    if (index >= paragraphs.size())
+        throw runtime_error("get_runs(): index out of bounds");
+    return paragraphs[index].runs;
+}
+
+void Term::TextViewWindow::append_paragraph(const u32string& s,
+                                            vector<TextRun> runs) {
+    insert_paragraph(paragraphs.size(), s, move(runs));
+}
+
+void Term::TextViewWindow::append_paragraph(const u32string& s,
+                                            FgColor a_fg,
+                                            BgColor a_bg,
+                                            style a_style) {
+    append_paragraph(s, vector<TextRun>{TextRun(0, a_fg, a_bg, a_style)});
+}
+
+void Term::TextViewWindow::append_paragraph(const string& s,
+                                            FgColor a_fg,
+                                            BgColor a_bg,
+                                            style a_style) {
+    append_paragraph(utf8_decode(s), a_fg, a_bg, a_style);
+}
+
+void Term::TextViewWindow::insert_paragraph(size_t index, const u32string& s,
+                                            vector<TextRun> runs) {
+    if (index > paragraphs.size())
+        throw runtime_error("insert_paragraph(): index out of bounds");
+    Paragraph par;
+    par.text = s;
+    par.runs = move(runs);
+    paragraphs.insert(paragraphs.begin() + index, move(par));
+    // the view stays with the text it shows
+    if (index <= top_paragraph && paragraphs.size() > 1) ++top_paragraph;
+    view_dirty = true;
+}
+
+void Term::TextViewWindow::set_paragraph(size_t index, const u32string& s,
+                                         vector<TextRun> runs) {
+    if (index >= paragraphs.size())
+        throw runtime_error("set_paragraph(): index out of bounds");
+    Paragraph& par = paragraphs[index];
+    par.text = s;
+    par.runs = move(runs);
+    par.stable_lo = par.stable_hi = 0;
+    if (index == top_paragraph) top_offset = min(top_offset, s.size());
+    view_dirty = true;
+}
+
+void Term::TextViewWindow::erase_paragraphs(size_t index, size_t n) {
+    if (index > paragraphs.size())
+        throw runtime_error("erase_paragraphs(): index out of bounds");
+    n = min(n, paragraphs.size() - index);
+    if (!n) return;
+    paragraphs.erase(paragraphs.begin() + index,
+                     paragraphs.begin() + index + n);
+    if (top_paragraph >= index + n) {
+        top_paragraph -= n;
+    } else if (top_paragraph >= index) {
+        top_paragraph = index;
+        top_offset = 0;
+    }
+    if (top_paragraph && top_paragraph == paragraphs.size()) {
+        --top_paragraph;
+        top_offset = 0;
+    }
+    view_dirty = true;
+}
+
+void Term::TextViewWindow::clear_text() {
+    paragraphs.clear();
+    top_paragraph = 0;
+    top_offset = 0;
+    view_dirty = true;
+}
+
+size_t Term::TextViewWindow::get_top_paragraph() const {
+    return top_paragraph;
+}
+
+size_t Term::TextViewWindow::get_top_line() const {
+    if (paragraphs.empty()) return 0;
+    return line_of(top_paragraph, top_offset);
+}
+
+void Term::TextViewWindow::scroll_to(size_t paragraph, size_t line) {
+    if (paragraphs.empty()) return;
+    paragraph = min(paragraph, paragraphs.size() - 1);
+    line = min(line, layout(paragraph).size() - 1);
+    // keep the view filled: count the lines from there on, up to h
+    size_t below = 0;
+    for (size_t p = paragraph, l = line; p != paragraphs.size() && below < h;
+         ++p, l = 0) {
+        below += layout(p).size() - l;
+    }
+    size_t offset = layout(paragraph)[line].first;
+    if (paragraph != top_paragraph || offset != top_offset) {
+        top_paragraph = paragraph;
+        top_offset = offset;
+        view_dirty = true;
+    }
+    if (below < h) scroll_up(h - below);
+}
+
+void Term::TextViewWindow::scroll_up(size_t n) {
+    if (paragraphs.empty()) return;
+    size_t p = top_paragraph;
+    size_t l = line_of(p, top_offset);
+    while (n) {
+        if (l) {
+            size_t step = min(n, l);
+            l -= step;
+            n -= step;
+        } else if (p) {
+            --p;
+            l = layout(p).size() - 1;
+            --n;
+        } else {
+            break;
+        }
+    }
+    size_t offset = layout(p)[l].first;
+    if (p != top_paragraph || offset != top_offset) {
+        top_paragraph = p;
+        top_offset = offset;
+        view_dirty = true;
+    }
+}
+
+void Term::TextViewWindow::scroll_down(size_t n) {
+    if (paragraphs.empty()) return;
+    size_t p = top_paragraph;
+    size_t l = line_of(p, top_offset);
+    while (n) {
+        size_t last = layout(p).size() - 1;
+        if (l != last) {
+            size_t step = min(n, last - l);
+            l += step;
+            n -= step;
+        } else if (p + 1 != paragraphs.size()) {
+            ++p;
+            l = 0;
+            --n;
+        } else {
+            break;
+        }
+    }
+    scroll_to(p, l);
+}
+
+size_t Term::TextViewWindow::get_line_count() const {
+    size_t count = 0;
+    for (size_t p = 0; p != paragraphs.size(); ++p) {
+        count += layout(p).size();
+    }
+    return count;
+}
+
+size_t Term::TextViewWindow::get_layout_count() const {
+    return layout_count;
+}
+
+void Term::TextViewWindow::set_w(size_t new_w) {
+    Window::set_w(new_w);
+    view_dirty = true;
+}
+
+void Term::TextViewWindow::set_h(size_t new_h) {
+    Window::set_h(new_h);
+    view_dirty = true;
+}
+
+void Term::TextViewWindow::set_grid(const vector<SharedRow>&) {
+    throw logic_error("TextViewWindow::set_grid(): the view shows the text");
+}
+
+void Term::TextViewWindow::clear_grid() {
+    Window::clear_grid();
+    view_dirty = true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "window.hpp"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Term {
+
+/* A word-wrapped view onto a text document, i.e. a list of paragraphs with
+ * attribute runs. The window keeps the text, so it reflows when its width
+ * changes. Each paragraph remembers the range of widths its line breaks are
+ * valid for, and the view is anchored at a position in a paragraph rather
+ * than at a line number. Resizing thus lays out the visible paragraphs
+ * only, and only those whose line breaks actually change; the others are
+ * laid out when scrolled to.
+ * All methods inherited from Window operate on the visible lines. Cells
+ * modified through them keep their changes until the view is refreshed,
+ * i.e. until it is scrolled, resized or the text is changed.
+ */
+class TextViewWindow : public Window {
+   protected :
+    struct Paragraph {
+        std::u32string text;
+        std::vector<TextRun> runs;
+        // the line breaks, valid for the widths [stable_lo, stable_hi) and
+        // layout_tabsize. Not laid out yet if the range is empty.
+        mutable std::vector<std::pair<size_t, size_t>> lines;
+        mutable size_t stable_lo{}, stable_hi{};
+        mutable size_t layout_tabsize{};
+    };
+    std::vector<Paragraph> paragraphs;
+    // the view starts with the line containing this position
+    size_t top_paragraph{};
+    size_t top_offset{}; // in codepoints
+
+    mutable std::vector<std::vector<Cell>> view;
+    mutable bool view_dirty{true};
+    mutable size_t layout_count{};
+
+    // the lines of paragraph p at the current width and tab size
+    const std::vector<std::pair<size_t, size_t>>& layout(size_t p) const;
+    // the index of the line of paragraph p which contains offset
+    size_t line_of(size_t p, size_t offset) const;
+    void render_line(const Paragraph&, size_t begin, size_t end,
+                     std::vector<Cell>& row) const;
+    // renders the visible lines into view, if necessary
+    void refresh_view() const;
+
+    const std::vector<Cell>* find_row(size_t y) const override;
+    std::vector<Cell>& access_row(size_t y) override;
+
+   public :
+    TextViewWindow(size_t width, size_t height);
+
+    size_t get_paragraph_count() const;
+    const std::u32string& get_paragraph(size_t) const;
+    const std::vector<TextRun>& get_runs(size_t) const;
+
+    // The run offsets must be ascending. Text in front of the first run
+    // gets the default attributes. CR and LF start a new line within the
+    // paragraph.
+    void append_paragraph(const std::u32string&,
+                          std::vector<TextRun> = {});
+    void append_paragraph(const std::u32string&, FgColor,
+                          BgColor = bg::unspecified,
+                          style = style::unspecified);
+    void append_paragraph(const std::string&,
+                          FgColor = fg::unspecified,
+                          BgColor = bg::unspecified,
+                          style = style::unspecified);
+    void insert_paragraph(size_t index, const std::u32string&,
+                          std::vector<TextRun> = {});
+    void set_paragraph(size_t index, const std::u32string&,
+                       std::vector<TextRun> = {});
+    void erase_paragraphs(size_t index, size_t n = 1);
+    void clear_text();
+
+    size_t get_top_paragraph() const;
+    size_t get_top_line() const; // within the top paragraph
+    void scroll_to(size_t paragraph, size_t line = 0);
+    // scrolling lays out the paragraphs passed, but keeps the view filled
+    void scroll_up(size_t n = 1);
+    void scroll_down(size_t n = 1);
+
+    // the number of lines of the whole document at the current width. Lays
+    // out every paragraph not laid out yet.
+    size_t get_line_count() const;
+    // the number of times a paragraph has been laid out so far
+    size_t get_layout_count() const;
+
+    void set_w(size_t) override;
+    void set_h(size_t) override;
+    // discards modifications of the visible cells
+    void clear_grid() override;
+    // throws, as the view is generated
+    using Window::set_grid;
+    void set_grid(const std::vector<SharedRow>&) override;
+};
+
+}  // namespace Term
@@ -0,0 +1,347 @@
+#include "utf8.hpp"
+#include <cstdint>
+#include <cstring>
+
+// x86-64 only, as there SSE2 can be taken for granted
+#if defined(__x86_64__) || defined(_M_X64)
+#define TERM_UTF8_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC does not need a target attribute for intrinsics
+#define TERM_TARGET_AVX2
+#else
+#define TERM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+
+namespace {
+
+const char32_t REPLACEMENT = 0xfffd;
+
+/* The kernels process the leading ASCII run of their input only and return
+ * its length. The caller handles everything else byte by byte.
+ */
+struct Kernels {
+    const char* name;
+    // length of the ASCII prefix of s[0..n)
+    size_t (*ascii_prefix)(const char* s, size_t n);
+    // likewise, while copying the prefix to out
+    size_t (*widen_ascii)(const char* s, size_t n, char32_t* out);
+    // length of the prefix of codepoints below 0x80, copied to out
+    size_t (*narrow_ascii)(const char32_t* s, size_t n, char* out);
+};
+
+size_t ascii_prefix_scalar(const char* s, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v;
+        memcpy(&v, s + i, 8);
+        if (v & 0x8080808080808080ull) break;
+    }
+    while (i != n && !(s[i] & 0x80)) ++i;
+    return i;
+}
+
+size_t widen_ascii_scalar(const char* s, size_t n, char32_t* out) {
+    size_t i = 0;
+    for (; i != n && !(s[i] & 0x80); ++i) {
+        out[i] = static_cast<char32_t>(s[i]);
+    }
+    return i;
+}
+
+size_t narrow_ascii_scalar(const char32_t* s, size_t n, char* out) {
+    size_t i = 0;
+    for (; i != n && s[i] < 0x80; ++i) {
+        out[i] = static_cast<char>(s[i]);
+    }
+    return i;
+}
+
+#ifdef TERM_UTF8_X86
+
+size_t ascii_prefix_sse2(const char* s, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        if (_mm_movemask_epi8(v)) break;
+    }
+    return i + ascii_prefix_scalar(s + i, n - i);
+}
+
+size_t widen_ascii_sse2(const char* s, size_t n, char32_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        if (_mm_movemask_epi8(v)) break;
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i* dst = reinterpret_cast<__m128i*>(out + i);
+        _mm_storeu_si128(dst, _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, zero));
+    }
+    return i + widen_ascii_scalar(s + i, n - i, out + i);
+}
+
+size_t narrow_ascii_sse2(const char32_t* s, size_t n, char* out) {
+    const __m128i high = _mm_set1_epi32(~0x7f);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i* src = reinterpret_cast<const __m128i*>(s + i);
+        __m128i a = _mm_loadu_si128(src);
+        __m128i b = _mm_loadu_si128(src + 1);
+        __m128i c = _mm_loadu_si128(src + 2);
+        __m128i d = _mm_loadu_si128(src + 3);
+        __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, high),
+                                              zero)) != 0xffff)
+            break;
+        // all values are below 0x80: packing cannot saturate
+        __m128i ab = _mm_packs_epi32(a, b);
+        __m128i cd = _mm_packs_epi32(c, d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                         _mm_packus_epi16(ab, cd));
+    }
+    return i + narrow_ascii_scalar(s + i, n - i, out + i);
+}
+
+TERM_TARGET_AVX2
+size_t ascii_prefix_avx2(const char* s, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        if (_mm256_movemask_epi8(v)) break;
+    }
+    return i + ascii_prefix_sse2(s + i, n - i);
+}
+
+TERM_TARGET_AVX2
+size_t widen_ascii_avx2(const char* s, size_t n, char32_t* out) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        if (_mm256_movemask_epi8(v)) break;
+        __m256i* dst = reinterpret_cast<__m256i*>(out + i);
+        for (int k = 0; k != 4; ++k) {
+            __m128i part = _mm_loadl_epi64(
+                reinterpret_cast<const __m128i*>(s + i + 8 * k));
+            _mm256_storeu_si256(dst + k, _mm256_cvtepu8_epi32(part));
+        }
+    }
+    return i + widen_ascii_sse2(s + i, n - i, out + i);
+}
+
+TERM_TARGET_AVX2
+size_t narrow_ascii_avx2(const char32_t* s, size_t n, char* out) {
+    const __m256i high = _mm256_set1_epi32(~0x7f);
+    // restores the order after the lane-wise packing
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i* src = reinterpret_cast<const __m256i*>(s + i);
+        __m256i a = _mm256_loadu_si256(src);
+        __m256i b = _mm256_loadu_si256(src + 1);
+        __m256i c = _mm256_loadu_si256(src + 2);
+        __m256i d = _mm256_loadu_si256(src + 3);
+        __m256i any =
+            _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if (!_mm256_testz_si256(any, high)) break;
+        __m256i ab = _mm256_packs_epi32(a, b);
+        __m256i cd = _mm256_packs_epi32(c, d);
+        __m256i abcd = _mm256_packus_epi16(ab, cd);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                            _mm256_permutevar8x32_epi32(abcd, order));
+    }
+    return i + narrow_ascii_sse2(s + i, n - i, out + i);
+}
+
+bool has_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    // the OS must save the AVX registers
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // TERM_UTF8_X86
+
+Kernels select_kernels() {
+#ifdef TERM_UTF8_X86
+    if (has_avx2()) {
+        return {"avx2", ascii_prefix_avx2, widen_ascii_avx2,
+                narrow_ascii_avx2};
+    }
+    return {"sse2", ascii_prefix_sse2, widen_ascii_sse2, narrow_ascii_sse2};
+#else
+    return {"scalar", ascii_prefix_scalar, widen_ascii_scalar,
+            narrow_ascii_scalar};
+#endif
+}
+
+const Kernels& kernels() {
+    static const Kernels k = select_kernels();
+    return k;
+}
+
+// Decodes the (non-ASCII) sequence at s. Returns the number of bytes
+// consumed, which is 1 with c = U+FFFD if the sequence is ill-formed.
+size_t decode_sequence(const unsigned char* s, size_t n, char32_t& c) {
+    unsigned char b = s[0];
+    size_t len;
+    // the valid range of the second byte (Unicode Table 3-7)
+    unsigned char lo = 0x80, hi = 0xbf;
+    if (b < 0x80) {
+        c = b;
+        return 1;
+    } else if (b < 0xc2) {
+        c = REPLACEMENT;
+        return 1;
+    } else if (b < 0xe0) {
+        len = 2;
+        c = b & 0x1f;
+    } else if (b < 0xf0) {
+        len = 3;
+        c = b & 0x0f;
+        if (b == 0xe0) lo = 0xa0;
+        else if (b == 0xed) hi = 0x9f; // no surrogates
+    } else if (b < 0xf5) {
+        len = 4;
+        c = b & 0x07;
+        if (b == 0xf0) lo = 0x90;
+        else if (b == 0xf4) hi = 0x8f; // nothing beyond U+10FFFF
+    } else {
+        c = REPLACEMENT;
+        return 1;
+    }
+    if (n < len || s[1] < lo || s[1] > hi) {
+        c = REPLACEMENT;
+        return 1;
+    }
+    for (size_t i = 1; i != len; ++i) {
+        if ((s[i] & 0xc0) != 0x80) {
+            c = REPLACEMENT;
+            return 1;
+        }
+        c = (c << 6) | (s[i] & 0x3f);
+    }
+    return len;
+}
+
+size_t encode_codepoint(char32_t c, char* out) {
+    if (c < 0x80) {
+        out[0] = static_cast<char>(c);
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = static_cast<char>(0xc0 | (c >> 6));
+        out[1] = static_cast<char>(0x80 | (c & 0x3f));
+        return 2;
+    }
+    if ((c >= 0xd800 && c < 0xe000) || c > 0x10ffff) c = REPLACEMENT;
+    if (c < 0x10000) {
+        out[0] = static_cast<char>(0xe0 | (c >> 12));
+        out[1] = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+        out[2] = static_cast<char>(0x80 | (c & 0x3f));
+        return 3;
+    }
+    out[0] = static_cast<char>(0xf0 | (c >> 18));
+    out[1] = static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+    out[2] = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+    out[3] = static_cast<char>(0x80 | (c & 0x3f));
+    return 4;
+}
+
+} // namespace
+
+bool Term::utf8_validate(const char* s, size_t n) {
+    const Kernels& k = kernels();
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    size_t i = 0;
+    while (i != n) {
+        i += k.ascii_prefix(s + i, n - i);
+        if (i == n) break;
+        char32_t c;
+        size_t len = decode_sequence(p + i, n - i, c);
+        if (c == REPLACEMENT && len == 1) return false;
+        i += len;
+    }
+    return true;
+}
+
+void Term::utf8_decode(const char* s, size_t n, u32string& out) {
+    const Kernels& k = kernels();
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    size_t pos = out.size();
+    // there are at most as many codepoints as bytes
+    out.resize(pos + n);
+    char32_t* dst = &out[0];
+    size_t i = 0;
+    while (i != n) {
+        size_t ascii = k.widen_ascii(s + i, n - i, dst + pos);
+        i += ascii;
+        pos += ascii;
+        if (i == n) break;
+        i += decode_sequence(p + i, n - i, dst[pos++]);
+    }
+    out.resize(pos);
+}
+
+u32string Term::utf8_decode(const string& s) {
+    u32string out;
+    utf8_decode(s.data(), s.size(), out);
+    return out;
+}
+
+void Term::utf8_encode(const char32_t* s, size_t n, string& out) {
+    const Kernels& k = kernels();
+    size_t pos = out.size();
+    out.resize(pos + 4 * n);
+    char* dst = &out[0];
+    size_t i = 0;
+    while (i != n) {
+        size_t ascii = k.narrow_ascii(s + i, n - i, dst + pos);
+        i += ascii;
+        pos += ascii;
+        if (i == n) break;
+        pos += encode_codepoint(s[i++], dst + pos);
+    }
+    out.resize(pos);
+}
+
+string Term::utf8_encode(const u32string& s) {
+    string out;
+    utf8_encode(s.data(), s.size(), out);
+    return out;
+}
+
+size_t Term::utf8_length(const char32_t* s, size_t n) {
+    size_t len = 0;
+    for (size_t i = 0; i != n; ++i) {
+        char32_t c = s[i];
+        if (c < 0x80) len += 1;
+        else if (c < 0x800) len += 2;
+        else if (c < 0x10000 || c > 0x10ffff) len += 3;
+        else len += 4;
+    }
+    return len;
+}
+
+const char* Term::utf8_kernels() {
+    return kernels().name;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Term {
+
+/* Bulk UTF-8 conversion. Runs of ASCII, i.e. most of any text written to or
+ * rendered by a window, are processed 16 or 32 bytes at a time using SSE2
+ * resp. AVX2, as detected at runtime on x86 processors. Everything else
+ * (and other processors) takes the scalar path. Results do not depend on
+ * the path taken.
+ */
+
+// true if s[0..n) is well-formed UTF-8 (no overlong forms, no surrogates,
+// nothing beyond U+10FFFF)
+bool utf8_validate(const char* s, size_t n);
+inline bool utf8_validate(const std::string& s) {
+    return utf8_validate(s.data(), s.size());
+}
+
+// Appends the decoded codepoints to out. Each byte which is not part of a
+// well-formed sequence is decoded as U+FFFD REPLACEMENT CHARACTER.
+void utf8_decode(const char* s, size_t n, std::u32string& out);
+std::u32string utf8_decode(const std::string&);
+
+// Appends the encoded codepoints to out. Surrogates and values beyond
+// U+10FFFF are encoded as U+FFFD.
+void utf8_encode(const char32_t* s, size_t n, std::string& out);
+std::string utf8_encode(const std::u32string&);
+
+// the number of bytes utf8_encode() produces for s[0..n)
+size_t utf8_length(const char32_t* s, size_t n);
+
+// the name of the kernels in use: "avx2", "sse2" or "scalar"
+const char* utf8_kernels();
+
+}  // namespace Term
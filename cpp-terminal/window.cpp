@@ -1,4 +1,7 @@
 #include "window.hpp"
+#include "grapheme.hpp"
+#include "palette.hpp"
+#include "utf8.hpp"
 // https://github.com/yhirose/cpp-unicodelib
 // disable some GCC/clang warnings (long files with a ton of warnings)
 #if defined(__GNUC__) || defined(__clang__)
@@ -13,11 +16,59 @@
 #if defined(__GNUC__) || defined(__clang__)
 #pragma GCC diagnostic pop
 #endif // defined
+#include <algorithm>
+#include <deque>
+#include <mutex>
 #include <stdexcept>
+#include <unordered_map>
 
 
 using namespace std;
 
+namespace {
+// the displayed size of a window, i.e. the frame of a framed child window
+size_t frame_w_of(Term::Window* win) {
+    if (win->is_base_window()) return win->get_w();
+    return static_cast<Term::ChildWindow*>(win)->get_frame_w();
+}
+
+size_t frame_h_of(Term::Window* win) {
+    if (win->is_base_window()) return win->get_h();
+    return static_cast<Term::ChildWindow*>(win)->get_frame_h();
+}
+
+// Ranges of codepoints which have NFC_Quick_Check=Yes, a canonical combining
+// class of 0 and never combine with a preceding character. A string of these
+// only is in NFC already. The list is far from complete (which just means
+// the slow path is taken), but covers what usually ends up in cells.
+const char32_t nfc_stable_ranges[][2] = {
+    {0x0000, 0x02ff},   // ASCII, Latin-1, Latin Extended-A/B, IPA, modifiers
+    {0x0400, 0x0482},   // Cyrillic
+    {0x048a, 0x052f},
+    {0x2002, 0x206f},   // General Punctuation (U+2000, U+2001 map to others)
+    {0x2190, 0x21ff},   // Arrows
+    {0x2500, 0x27bf},   // Box Drawing, Block Elements, Shapes, Dingbats
+    {0x3041, 0x3096},   // Hiragana (without the combining sound marks)
+    {0x30a1, 0x30fa},   // Katakana
+    {0x4e00, 0x9fff},   // CJK Unified Ideographs
+    {0xac00, 0xd7a3},   // Hangul Syllables
+    {0xfe00, 0xfe0f},   // Variation Selectors
+    {0x1f000, 0x1faff}, // Emoji and other symbols
+};
+
+bool is_nfc_stable(char32_t c) {
+    if (c < 0x300) return true; // the common case
+    size_t lo = 0, hi = sizeof(nfc_stable_ranges) / sizeof(*nfc_stable_ranges);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (c > nfc_stable_ranges[mid][1]) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo != sizeof(nfc_stable_ranges) / sizeof(*nfc_stable_ranges) &&
+           c >= nfc_stable_ranges[lo][0];
+}
+} // namespace
+
 /***************
    Term::Color
  ***************/
@@ -112,6 +163,62 @@ bool Term::BgColor::is_unspecified() const {
     return (rgb_mode == false && bg_val == bg::unspecified);
 }
 
+/**********************
+ * Term::GraphemePool
+ **********************
+ */
+
+namespace {
+struct GraphemePoolData {
+    std::mutex mtx;
+    std::deque<u32string> entries; // deque: entries are never moved
+    std::unordered_map<u32string, uint32_t> index;
+    size_t capacity = 1 << 16;
+};
+
+GraphemePoolData& grapheme_pool() {
+    static GraphemePoolData pool;
+    return pool;
+}
+} // namespace
+
+uint32_t Term::GraphemePool::intern(const u32string& s) {
+    GraphemePoolData& pool = grapheme_pool();
+    lock_guard<mutex> lock(pool.mtx);
+    auto it = pool.index.find(s);
+    if (it != pool.index.end()) return it->second;
+    if (pool.entries.size() >= pool.capacity) return FULL;
+    uint32_t i = static_cast<uint32_t>(pool.entries.size());
+    pool.entries.push_back(s);
+    pool.index.emplace(s, i);
+    return i;
+}
+
+const u32string& Term::GraphemePool::get(uint32_t i) {
+    GraphemePoolData& pool = grapheme_pool();
+    lock_guard<mutex> lock(pool.mtx);
+    return pool.entries.at(i);
+}
+
+size_t Term::GraphemePool::size() {
+    GraphemePoolData& pool = grapheme_pool();
+    lock_guard<mutex> lock(pool.mtx);
+    return pool.entries.size();
+}
+
+size_t Term::GraphemePool::get_capacity() {
+    GraphemePoolData& pool = grapheme_pool();
+    lock_guard<mutex> lock(pool.mtx);
+    return pool.capacity;
+}
+
+void Term::GraphemePool::set_capacity(size_t capacity) {
+    GraphemePoolData& pool = grapheme_pool();
+    lock_guard<mutex> lock(pool.mtx);
+    // the indices must not reach the POOLED bit
+    pool.capacity = min<size_t>(capacity, Cell::POOLED);
+}
+
 /**************
  * Term::Cell
  **************
@@ -121,16 +228,14 @@ Term::Cell::Cell()
     : cell_fg(fg::unspecified)
     , cell_bg(bg::unspecified)
     , cell_style(style::unspecified)
-    , grapheme_length(0)
-    , ch(U"")
+    , grapheme(U'\0')
 {}
 
 Term::Cell::Cell(char32_t c)
     : cell_fg(fg::unspecified)
     , cell_bg(bg::unspecified)
     , cell_style(style::unspecified)
-    , grapheme_length(1)
-    , ch{c}
+    , grapheme(c)
 {}
 
 Term::Cell::Cell(const u32string& s){
@@ -145,19 +250,107 @@ Term::Cell::Cell(
     : cell_fg(a_fg)
     , cell_bg(a_bg)
     , cell_style(a_style)
-    , grapheme_length(1)
-    , ch{c}
+    , grapheme(c)
 {}
 
 Term::Cell::Cell(const u32string& s, FgColor a_fg, BgColor a_bg, style a_style)
     : cell_fg(a_fg), cell_bg(a_bg), cell_style(a_style) {
-    if (unicode::grapheme_count(s) > 1)
+    if (grapheme_length(s) != s.size())
         throw runtime_error("Cell::Cell() string has more than 1 grapheme");
-    if (s.size() > MAX_GRAPHEME_LENGTH)
-        throw runtime_error(
-            "Window::set_grapheme(): grapheme exceeds MAX_GRAPHEME_LENGTH");
-    grapheme_length = s.size();
-    s.copy(ch, s.size());
+    set_grapheme(s);
+}
+
+bool Term::Cell::is_empty() const {
+    return grapheme == U'\0';
+}
+
+bool Term::Cell::is_wide_tail() const {
+    return grapheme == WIDE_TAIL;
+}
+
+size_t Term::Cell::get_grapheme_length() const {
+    if (grapheme & POOLED)
+        return GraphemePool::get(grapheme & ~POOLED).size();
+    return (grapheme == U'\0' || grapheme == WIDE_TAIL) ? 0 : 1;
+}
+
+size_t Term::Cell::get_width() const {
+    if (grapheme & POOLED)
+        return grapheme_width(GraphemePool::get(grapheme & ~POOLED));
+    return grapheme_width(&grapheme, 1);
+}
+
+u32string Term::Cell::get_grapheme() const {
+    if (grapheme & POOLED)
+        return GraphemePool::get(grapheme & ~POOLED);
+    if (grapheme == U'\0' || grapheme == WIDE_TAIL) return U"";
+    return u32string(1, grapheme);
+}
+
+void Term::Cell::set_grapheme(const u32string& s) {
+    // single codepoints (by far the most common case) are stored inline
+    if (s.empty()) grapheme = U'\0';
+    else if (s.size() == 1) grapheme = s[0];
+    else {
+        const uint32_t i = GraphemePool::intern(s);
+        grapheme = (i == GraphemePool::FULL ? U'\uFFFD' : POOLED | i);
+    }
+}
+
+void Term::Cell::set_char(char32_t c) {
+    grapheme = c;
+}
+
+void Term::Cell::append_grapheme(u32string& out) const {
+    if (grapheme & POOLED)
+        out.append(GraphemePool::get(grapheme & ~POOLED));
+    else if (grapheme != U'\0' && grapheme != WIDE_TAIL)
+        out.push_back(grapheme);
+}
+
+bool Term::Cell::operator==(const Cell& cell) const {
+    return grapheme == cell.grapheme && cell_style == cell.cell_style &&
+           cell_fg == cell.cell_fg && cell_bg == cell.cell_bg;
+}
+
+bool Term::Cell::operator!=(const Cell& cell) const {
+    return !operator==(cell);
+}
+
+/*******************
+ * Term::SharedRow
+ *******************
+ */
+
+Term::SharedRow::SharedRow(vector<Cell> row)
+    : cells(make_shared<vector<Cell>>(std::move(row)))
+{}
+
+size_t Term::SharedRow::size() const {
+    return cells ? cells->size() : 0;
+}
+
+const vector<Term::Cell>* Term::SharedRow::get() const {
+    return cells.get();
+}
+
+vector<Term::Cell>& Term::SharedRow::modify() {
+    if (!cells) {
+        cells = make_shared<vector<Cell>>();
+    } else if (cells.use_count() > 1) {
+        // copy on write
+        cells = make_shared<vector<Cell>>(*cells);
+    }
+    return *cells;
+}
+
+void Term::SharedRow::clear() {
+    if (cells && cells.use_count() == 1) cells->clear();
+    else cells.reset();
+}
+
+bool Term::SharedRow::is_shared() const {
+    return cells && cells.use_count() > 1;
 }
 
 /****************
@@ -186,32 +379,158 @@ Term::Window::~Window() {
     }
 }
 
-void Term::Window::assure_pos(size_t x, size_t y){
+Term::Cell& Term::Window::assure_pos(size_t x, size_t y){
     if (y >= h) {
         if (height_fixed) throw std::runtime_error("y out of bounds");
-        h = y + 1;
-        grid.resize(h);
+        set_h(y + 1);
     }
     if (x >= w) {
         if (width_fixed) throw std::runtime_error("x out of bounds");
         w = x + 1;
     }
-    if (x >= grid[y].size()) {
-        grid[y].resize(x + 1);
+    return access_cell(x, y);
+}
+
+const vector<Term::Cell>* Term::Window::find_row(size_t y) const {
+    if (y < grid.size()) return grid[y].get();
+    return nullptr;
+}
+
+vector<Term::Cell>& Term::Window::access_row(size_t y) {
+    if (y >= grid.size()) grid.resize(y + 1);
+    return grid[y].modify();
+}
+
+const Term::SharedRow* Term::Window::find_shared_row(size_t y) const {
+    if (y < grid.size()) return &grid[y];
+    return nullptr;
+}
+
+const Term::Cell* Term::Window::find_cell(size_t x, size_t y) const {
+    const vector<Cell>* row = find_row(y);
+    if (row && x < row->size()) return &(*row)[x];
+    return nullptr;
+}
+
+Term::Cell& Term::Window::access_cell(size_t x, size_t y) {
+    vector<Cell>& row = access_row(y);
+    if (x >= row.size()) {
+        row.resize(x + 1, get_blank_cell());
+    }
+    return row[x];
+}
+
+void Term::Window::store_cells(size_t x, size_t y,
+                               const Cell* cells, size_t n) {
+    vector<Cell>& row = access_row(y);
+    if (row.size() < x) row.resize(x, get_blank_cell());
+    // overwrite what is there, append the rest (without constructing it
+    // first)
+    size_t overlap = min(n, row.size() - x);
+    copy(cells, cells + overlap, row.begin() + x);
+    row.insert(row.end(), cells + overlap, cells + n);
+    if (resolving_defaults) {
+        for (size_t i = x; i != x + n; ++i) resolve(row[i]);
+    }
+}
+
+void Term::Window::release_wide(size_t x, size_t y, size_t n) {
+    const Cell* first = find_cell(x, y);
+    if (x && first && first->is_wide_tail()) {
+        const Cell* head = find_cell(x - 1, y);
+        if (head && !head->is_wide_tail())
+            access_cell(x - 1, y).set_char(U' ');
     }
+    const Cell* next = find_cell(x + n, y);
+    if (n && next && next->is_wide_tail())
+        access_cell(x + n, y).set_char(U' ');
+}
+
+void Term::Window::scroll_rows(size_t n) {
+    n = min(n, grid.size());
+    rotate(grid.begin(), grid.begin() + n, grid.end());
+    for (size_t y = grid.size() - n; y != grid.size(); ++y) {
+        grid[y].clear();
+    }
+}
+
+void Term::Window::copy_rect(size_t x0, size_t y0,
+                             size_t width, size_t height,
+                             vector<SharedRow>& dest) const {
+    dest.assign(height, SharedRow());
+    for (size_t y = 0; y != height; ++y) {
+        const vector<Cell>* row = find_row(y0 + y);
+        // share the row if it is a SharedRow (and not, e.g., a row of a
+        // derived window which only overrides find_row())
+        const SharedRow* shared = find_shared_row(y0 + y);
+        if (shared && shared->get() == row && x0 == 0 &&
+            shared->size() <= width) {
+            dest[y] = *shared;
+            continue;
+        }
+        if (!row || x0 >= row->size()) continue;
+        size_t x1 = min(row->size(), x0 + width);
+        dest[y].modify().assign(row->begin() + x0, row->begin() + x1);
+    }
+}
+
+void Term::Window::resolve_stored_cells() {
+    for (size_t y = 0; y != h; ++y) {
+        const vector<Cell>* row = find_row(y);
+        if (!row) continue;
+        auto unresolved = [](const Cell& c) {
+            return c.cell_fg.is_unspecified() || c.cell_bg.is_unspecified() ||
+                   c.cell_style == style::unspecified;
+        };
+        // rows shared with copies are cloned only if they need it
+        if (none_of(row->begin(), row->end(), unresolved)) continue;
+        for (Cell& c : access_row(y)) resolve(c);
+    }
+}
+
+Term::Cell Term::Window::get_blank_cell() const {
+    if (!resolving_defaults) return Cell();
+    return Cell(U'\0', default_fg, default_bg, default_style);
+}
+
+void Term::Window::resolve(Cell& c) const {
+    if (!resolving_defaults) return;
+    if (c.cell_fg.is_unspecified()) c.cell_fg = default_fg;
+    if (c.cell_bg.is_unspecified()) c.cell_bg = default_bg;
+    if (c.cell_style == style::unspecified) c.cell_style = default_style;
+}
+
+bool Term::Window::are_defaults_resolved() const {
+    if (!resolving_defaults) return false;
+    for (const ChildWindow* cwin : children) {
+        if (cwin->is_visible() && !cwin->are_defaults_resolved())
+            return false;
+    }
+    return true;
 }
 
 size_t Term::Window::simple_write(const std::u32string& s,
                                        FgColor a_fg,
                                        BgColor a_bg,
                                        style a_style) {
+    return simple_write(s.data(), s.size(), a_fg, a_bg, a_style);
+}
+
+size_t Term::Window::simple_write(const char32_t* s,
+                                  size_t n,
+                                  FgColor a_fg,
+                                  BgColor a_bg,
+                                  style a_style) {
+    const TextRun run(0, a_fg, a_bg, a_style);
+    return simple_write(s, n, &run, 1, 0);
+}
+
+size_t Term::Window::simple_write(const char32_t* s,
+                                  size_t n,
+                                  const TextRun* runs,
+                                  size_t run_count,
+                                  size_t base) {
     using Term::Key;
-    if (a_fg == fg::unspecified)
-        a_fg = default_fg;
-    if (a_bg == bg::unspecified)
-        a_bg = default_bg;
-    if (a_style == style::unspecified)
-        a_style = default_style;
     if (cursor.y >= h && height_fixed) {
         // out of the window. Should not happen here: just to be safe.
         cursor.y = h - 1;
@@ -222,14 +541,48 @@ size_t Term::Window::simple_write(const std::u32string& s,
     size_t x = cursor.x;
     size_t y = cursor.y;
 
+    // the attributes in effect, resolved once per run
+    FgColor a_fg = default_fg;
+    BgColor a_bg = default_bg;
+    style a_style = default_style;
+    auto apply = [&](const TextRun& run) {
+        a_fg = (run.fg == fg::unspecified ? default_fg : run.fg);
+        a_bg = (run.bg == bg::unspecified ? default_bg : run.bg);
+        a_style = (run.st == style::unspecified ? default_style : run.st);
+    };
+    size_t next_run = upper_bound(runs, runs + run_count, base,
+                                  [](size_t off, const TextRun& run) {
+                                      return off < run.offset;
+                                  }) - runs;
+    if (next_run) apply(runs[next_run - 1]);
+
+    // The cells written into row y are collected in line, starting at
+    // column line_x, and stored in one go when moving on to another row.
+    static thread_local vector<Cell> line;
+    line.clear();
+    size_t line_x = x;
+    auto flush = [&]() {
+        if (line.empty()) return;
+        if (y >= h) set_h(y + 1); // the height is not fixed then
+        release_wide(line_x, y, line.size());
+        store_cells(line_x, y, line.data(), line.size());
+        line.clear();
+    };
+
+    u32string grapheme;
     size_t i = 0;
     size_t sz = 0;
-    for (; i != s.size(); i += sz) {
-        sz = unicode::grapheme_length(s.data() + i);
-        u32string grapheme = s.substr(i, sz);
-        bool newline = (grapheme[0] == CR || grapheme[0] == LF || 
-                        (x >= w && width_fixed));
+    for (; i != n; i += sz) {
+        sz = grapheme_length(s + i, n - i);
+        while (next_run != run_count && runs[next_run].offset <= base + i)
+            apply(runs[next_run++]);
+        const char32_t c = s[i];
+        // a wide grapheme takes two cells, which must be in the same row
+        size_t cells = grapheme_width(s + i, sz);
+        if (cells == 2 && width_fixed && w < 2) cells = 1;
+        bool newline = (c == CR || c == LF || (x + cells > w && width_fixed));
         if (newline) {
+            flush();
             ++y;
             if (y >= h) {
                 if (height_fixed) {
@@ -242,56 +595,57 @@ size_t Term::Window::simple_write(const std::u32string& s,
                 // adjust window height
                 set_h(y + 1);
             }
-            x = 0;
-            if (grapheme[0] == CR || grapheme[0] == LF)
+            x = line_x = 0;
+            if (c == CR || c == LF)
                 continue;
         }
 
         // tab
-        if (grapheme[0] == Key::TAB && tabsize) {
+        if (c == Key::TAB && tabsize) {
             size_t no_of_blanks = tabsize - (x % tabsize);
             if (x + no_of_blanks > w)
                 no_of_blanks = w - x;
-            for (size_t j = 0; j != no_of_blanks; ++j) {
-                set_grapheme(x, y, U" ");
-                set_fg(x, y, a_fg);
-                set_bg(x, y, a_bg);
-                set_style(x, y, a_style);
-                ++x;
-            }
-        } else if (grapheme[0] >= U' ' && grapheme[0] <= UTF8_MAX) {
+            line.resize(line.size() + no_of_blanks,
+                        Cell(U' ', a_fg, a_bg, a_style));
+            x += no_of_blanks;
+        } else if (c >= U' ' && c <= UTF8_MAX) {
             if ((x >= w && width_fixed) || (y >= h && height_fixed)) {
                 // out of the window
                 break;
             }
-            set_grapheme(x, y, grapheme);
-            set_fg(x, y, a_fg);
-            set_bg(x, y, a_bg);
-            set_style(x, y, a_style);
-            ++x;
+            // normalize to composed, just like set_grapheme()
+            grapheme.assign(s + i, sz);
+            line.emplace_back(U'\0', a_fg, a_bg, a_style);
+            line.back().set_grapheme(to_nfc(grapheme));
+            if (cells == 2)
+                line.emplace_back(Cell::WIDE_TAIL, a_fg, a_bg, a_style);
+            x += cells;
+            // a window of fixed width has wrapped before
+            if (x > w) w = x;
         }
         if (x < w)
             continue;
         // Right margin exceeded. Ignore that if the next character in
         // the string is a newline character anyway:
-        if (i + 1 != s.size() && (s[i + 1] == CR || s[i + 1] == LF))
+        if (i + 1 != n && (s[i + 1] == CR || s[i + 1] == LF))
             continue;
         // If allowed, adjust the width of the window
         if (!width_fixed) {
             set_w(x + 1);
             continue;
         }
+        flush();
         // Otherwise, start new line
         if (y < h - 1) {
             ++y;
-            x = 0;
+            x = line_x = 0;
             continue;
         }
         // If at bottom line, either grow height if allowed ...
         if (!height_fixed) {
             ++y;
             set_h(y + 1);
-            x = 0;
+            x = line_x = 0;
             continue;
         }
         // ... or keep cursor in bottom right corner and exit loop
@@ -300,6 +654,7 @@ size_t Term::Window::simple_write(const std::u32string& s,
         i += sz;
         break;
     }
+    flush();
     // set cursor
     cursor.x = x;
     cursor.y = y;
@@ -310,9 +665,9 @@ size_t Term::Window::simple_write(const std::string& s,
                                        FgColor a_fg,
                                        BgColor a_bg,
                                        style a_style) {
-    std::u32string s32 = unicode::utf8::decode(s);
+    std::u32string s32 = utf8_decode(s);
     size_t i = simple_write(s32, a_fg, a_bg, a_style);
-    return unicode::utf8::encode(s32.substr(0, i)).size();
+    return utf8_length(s32.data(), i);
 }
 
 size_t Term::Window::simple_write(char32_t ch,
@@ -323,72 +678,245 @@ size_t Term::Window::simple_write(char32_t ch,
     return simple_write(s32, a_fg, a_bg, a_style);
 }
 
+void Term::Window::wrap_lines(const u32string& s, size_t x0,
+                              vector<pair<size_t, size_t>>& lines,
+                              pair<size_t, size_t>* stable) const {
+    using Term::Key;
+    enum : uint8_t { SPACE = 1, AFTER = 2, BEFORE = 4 };
+    // wrap classes of the ASCII characters, looked up rather than searched
+    uint8_t ascii[128] = {};
+    for (char32_t c = 0; c != 128; ++c) {
+        if (unicode::is_white_space(c)) ascii[c] |= SPACE;
+    }
+    for (char32_t c : wrap_after) {
+        if (c < 128) ascii[c] |= AFTER;
+    }
+    for (char32_t c : wrap_before) {
+        if (c < 128) ascii[c] |= BEFORE;
+    }
+    auto classify = [&](char32_t c) -> uint8_t {
+        if (c < 128) return ascii[c];
+        uint8_t k = unicode::is_white_space(c) ? SPACE : 0;
+        if (wrap_after.find(c) != u32string::npos) k |= AFTER;
+        if (wrap_before.find(c) != u32string::npos) k |= BEFORE;
+        return k;
+    };
+    const size_t n = s.size();
+    const size_t npos = static_cast<size_t>(-1);
+    lines.clear();
+    size_t begin = 0;     // of the current line
+    size_t line_x = x0;   // the column the current line starts at
+    size_t x = x0;
+    size_t brk = npos;    // the last break opportunity in the current line
+    size_t brk_x = 0;     // the column at brk
+    uint8_t prev = 0;     // class of the previous grapheme
+    // The result stays the same for any width at which everything placed
+    // still fits (up to max_x) and nothing that overflowed does (from
+    // min_overflow on).
+    size_t max_x = x0;
+    size_t min_overflow = npos;
+    size_t len = 0;
+    for (size_t i = 0; i != n; i += len) {
+        len = grapheme_length(s.data() + i, n - i);
+        const char32_t c = s[i];
+        const uint8_t k = classify(c);
+        // a line may start after whitespace and wrap_after characters
+        // as well as before whitespace and wrap_before characters
+        if (i != begin &&
+            ((prev & (SPACE | AFTER)) || (k & (SPACE | BEFORE)))) {
+            brk = i;
+            brk_x = x;
+        }
+        prev = k;
+        if (c == Key::CR || c == Key::LF) {
+            lines.emplace_back(begin, i);
+            begin = i + len;
+            x = line_x = 0;
+            brk = npos;
+            continue;
+        }
+        // the cells taken, as by simple_write()
+        auto cells = [&]() -> size_t {
+            if (c == Key::TAB) {
+                if (!tabsize) return 0;
+                size_t blanks = tabsize - (x % tabsize);
+                if (x >= w || blanks <= w - x) return blanks;
+                // cut off at the margin: different at any other width
+                min_overflow = min(min_overflow, w + 1);
+                return w - x;
+            }
+            if (c < U' ' || c > UTF8_MAX) return 0;
+            return w > 1 ? grapheme_width(s.data() + i, len) : 1;
+        };
+        size_t cw = cells();
+        if (!cw || x + cw <= w) {
+            x += cw;
+            max_x = max(max_x, x);
+            continue;
+        }
+        // the grapheme does not fit into the current line (a tab would,
+        // cut off, at any width beyond x)
+        min_overflow = min(min_overflow, x + (c == Key::TAB ? 1 : cw));
+        if ((k & SPACE) && skip_whitespace_at_eol) {
+            // skip it
+            lines.emplace_back(begin, i);
+            begin = i + len;
+            x = line_x = 0;
+            brk = npos;
+            continue;
+        }
+        if (brk != npos) {
+            // wrap at the last opportunity
+            lines.emplace_back(begin, brk);
+            begin = brk;
+            x -= brk_x;
+            line_x = 0;
+            brk = npos;
+        } else if (line_x) {
+            // move the word from behind the text already present (which
+            // the window holds, not s) to the next line
+            lines.emplace_back(begin, begin);
+            x -= line_x;
+            line_x = 0;
+        }
+        if (x && x + cells() > w) {
+            // the word is longer than a line: break it up
+            min_overflow = min(min_overflow,
+                               x + (c == Key::TAB ? 1 : cells()));
+            lines.emplace_back(begin, i);
+            begin = i;
+            x = line_x = 0;
+        }
+        x += cells();
+        max_x = max(max_x, x);
+    }
+    lines.emplace_back(begin, n);
+    if (stable) {
+        // below 2 cells, wide graphemes take one cell
+        if (w < 2) *stable = make_pair(w, w + 1);
+        else *stable = make_pair(max(max_x, size_t(2)), min_overflow);
+    }
+}
+
 size_t Term::Window::write_wordwrap(const std::u32string& s,
                                     FgColor a_fg,
                                     BgColor a_bg,
                                     style a_style) {
-    size_t i = 0;
-    size_t total_count = 0;
-    size_t written = 0;
-    while (i != s.size()) {
-        if (cursor.x >= w)
-            throw runtime_error("write_wordwrap(): cursor out of window");
-        size_t x = cursor.x;
-        size_t j = i;
-        
-        bool print_so_far = false;
-        bool newline_first = false;
-        bool skip_next = false;
-        while (!print_so_far) {
-            print_so_far = unicode::is_white_space(s[j]) ||
-                           wrap_after.find(s[j]) != string::npos;
-            // j to next grapheme
-            j += unicode::grapheme_length(s.data() + j);
-            ++x;
-            if (j == s.size()) break;
-            print_so_far |= unicode::is_white_space(s[j]) ||
-                            wrap_before.find(s[j]) != string::npos;
-            // end of line?
-            if (x == w) {
-                skip_next = unicode::is_white_space(s[j]) && 
-                            skip_whitespace_at_eol;
-                newline_first = (cursor.x && !skip_next && !print_so_far);
-                print_so_far = true;    
-            }
-        }
-        if (newline_first) {
-            written = simple_write(Key::LF, a_fg, a_bg, a_style);
-            if (!written) return total_count;
+    const TextRun run(0, a_fg, a_bg, a_style);
+    return write_wordwrap(s, &run, 1);
+}
+
+size_t Term::Window::write_wordwrap(const std::u32string& s,
+                                    const TextRun* runs,
+                                    size_t run_count) {
+    if (cursor.x >= w)
+        throw runtime_error("write_wordwrap(): cursor out of window");
+    // Re-layout of the same text in the same place is a lookup. The entries
+    // hold copies of the text, so large texts are not cached.
+    struct CacheEntry {
+        u32string text;
+        size_t width{}, start_x{}, tabsize{};
+        bool skip_whitespace{};
+        u32string wrap_after, wrap_before;
+        vector<pair<size_t, size_t>> lines;
+    };
+    static thread_local CacheEntry cache[8];
+    static thread_local size_t next_entry = 0;
+    CacheEntry* entry = nullptr;
+    for (CacheEntry& e : cache) {
+        if (e.width == w && e.start_x == cursor.x && e.tabsize == tabsize &&
+            e.skip_whitespace == skip_whitespace_at_eol && e.text == s &&
+            e.wrap_after == wrap_after && e.wrap_before == wrap_before &&
+            !e.lines.empty()) {
+            entry = &e;
+            break;
         }
-        written = simple_write(s.substr(i, j - i), a_fg, a_bg, a_style);
-        total_count += written;
-        if (written != j - i) return total_count;
-        i = j;
-        if (skip_next && i != s.size()) {
-            i += unicode::grapheme_length(s.data() + i);
-            ++total_count;
+    }
+    vector<pair<size_t, size_t>> uncached;
+    const vector<pair<size_t, size_t>>* lines = &uncached;
+    if (entry) {
+        lines = &entry->lines;
+    } else if (s.size() <= 0x10000) {
+        entry = &cache[next_entry];
+        next_entry = (next_entry + 1) % 8;
+        wrap_lines(s, cursor.x, entry->lines);
+        entry->text = s;
+        entry->width = w;
+        entry->start_x = cursor.x;
+        entry->tabsize = tabsize;
+        entry->skip_whitespace = skip_whitespace_at_eol;
+        entry->wrap_after = wrap_after;
+        entry->wrap_before = wrap_before;
+        lines = &entry->lines;
+    } else {
+        wrap_lines(s, cursor.x, uncached);
+    }
+    size_t done = 0;
+    bool wrapped = false; // simple_write() moved on to the next line itself
+    for (size_t l = 0; l != lines->size(); ++l) {
+        const size_t begin = (*lines)[l].first;
+        const size_t end = (*lines)[l].second;
+        if (l && !wrapped) {
+            if (!simple_write(Key::LF)) return done;
         }
+        const size_t y = cursor.y;
+        size_t written = simple_write(s.data() + begin, end - begin,
+                                      runs, run_count, begin);
+        if (written != end - begin) return begin + written;
+        wrapped = (begin != end && cursor.x == 0 && cursor.y != y);
+        // including the line break or whitespace skipped
+        done = (l + 1 != lines->size() ? (*lines)[l + 1].first : s.size());
     }
-    return total_count;
+    return done;
 }
 
 size_t Term::Window::write_wordwrap(const std::string& s,
                                     FgColor a_fg,
                                     BgColor a_bg,
                                     style a_style) {
-    std::u32string s32 = unicode::utf8::decode(s);
+    std::u32string s32 = utf8_decode(s);
     size_t i = write_wordwrap(s32, a_fg, a_bg, a_style);
-    return unicode::utf8::encode(s32.substr(0, i)).size();
+    return utf8_length(s32.data(), i);
 }
 
 Term::Window Term::Window::merge_children() const {
-    Window res(w, h);
-    res.copy_grid_from(*this);
+    return merge_children(0, 0, w, h);
+}
+
+Term::Window Term::Window::merge_children(size_t x0, size_t y0,
+                                          size_t width,
+                                          size_t height) const {
+    // only the cells inside the cut-out are copied
+    Window res = cutout(x0, y0, width, height);
+    // If all windows resolve the defaults, so does the result. The cells
+    // created by merging (e.g. under a border) get our defaults then, as
+    // the renderers would give them; missing cells still read as reset.
+    const bool resolved = are_defaults_resolved();
+    if (resolved) {
+        res.default_fg = default_fg;
+        res.default_bg = default_bg;
+        res.default_style = default_style;
+        res.resolving_defaults = true;
+    }
     for (const ChildWindow* cwin : children) {
         // merge_into_grid() is recursive
-        cwin->merge_into_grid(&res, 0, 0, w, h);
+        cwin->merge_into_grid(&res, -static_cast<ptrdiff_t>(x0),
+                              -static_cast<ptrdiff_t>(y0), w, h);
     }
-    res.cursor = get_visual_cursor();
+    if (resolved) {
+        res.default_fg = fg::reset;
+        res.default_bg = bg::reset;
+        res.default_style = style::reset;
+    }
+    Cursor cur = get_visual_cursor();
+    if (cur.x < x0 || cur.x >= x0 + width || cur.y < y0 ||
+        cur.y >= y0 + height) {
+        cur = Cursor(0, 0, false);
+    } else {
+        cur.x -= x0;
+        cur.y -= y0;
+    }
+    res.cursor = cur;
     return res;
 }
 
@@ -401,7 +929,7 @@ void Term::Window::set_w(size_t new_w) {
     w = new_w;
     for (size_t y = 0; y != grid.size(); ++y) {
         if (grid[y].size() > w)
-            grid[y].resize(w);
+            grid[y].modify().resize(w);
     }
     // TODO inconsistent! Make decision if w == 0 or h == 0
     // are allowed at all and what to do with the cursor then.
@@ -417,8 +945,10 @@ void Term::Window::trim_w(size_t minimal_width) {
         return;
     }
     size_t x = minimal_width;
-    for (const auto& row : grid)
-        x = max(x, row.size());
+    for (size_t y = 0; y != h; ++y) {
+        const vector<Cell>* row = find_row(y);
+        if (row) x = max(x, row->size());
+    }
     // make sure the cursor remains in the window
     x = max(x, cursor.x + 1);
     set_w(x);
@@ -438,13 +968,14 @@ void Term::Window::set_h(size_t new_h) {
 
 void Term::Window::trim_h(size_t minimal_height) {
     // TODO test for content, not only size of rows!
-    if (h <= minimal_height || grid.size() <= minimal_height) {
+    if (h <= minimal_height) {
         set_h(minimal_height);
         return;
     }
-    size_t y = min(h, grid.size());
+    size_t y = h;
     for (; y > minimal_height; --y) {
-        if (grid[y - 1].size())
+        const vector<Cell>* row = find_row(y - 1);
+        if (row && row->size())
             break;
     }
     // make sure the cursor remains in the window
@@ -536,117 +1067,161 @@ void Term::Window::set_tabsize(size_t ts) {
     tabsize = ts;
 }
 
-uint8_t Term::Window::get_grapheme_length(size_t x, size_t y) const {
-    if (y < grid.size() && x < grid[y].size())
-        return grid[y][x].grapheme_length;
+size_t Term::Window::get_grapheme_length(size_t x, size_t y) const {
+    const Cell* cell = find_cell(x, y);
+    if (cell)
+        return cell->get_grapheme_length();
     return 0;
 }
 
 u32string Term::Window::get_grapheme(size_t x, size_t y) const {
-    if (y < grid.size() && x < grid[y].size())
-        return std::u32string(grid[y][x].ch, grid[y][x].grapheme_length);
+    const Cell* cell = find_cell(x, y);
+    if (cell)
+        return cell->get_grapheme();
     return U"";
 }
 
+const u32string& Term::Window::to_nfc(const u32string& s) {
+    bool stable = true;
+    for (char32_t c : s) {
+        if (!is_nfc_stable(c)) {
+            stable = false;
+            break;
+        }
+    }
+    if (stable) return s;
+    struct Entry {
+        u32string in, out;
+    };
+    static thread_local Entry cache[64];
+    Entry& e = cache[hash<u32string>()(s) % 64];
+    if (e.in != s || e.out.empty()) {
+        e.in = s;
+        e.out = unicode::to_nfc(s);
+    }
+    return e.out;
+}
+
 void Term::Window::set_grapheme(size_t x, size_t y, const u32string& s) {
     assure_pos(x, y);
-    if (unicode::grapheme_count(s) > 1)
+    if (grapheme_length(s) != s.size())
         throw runtime_error("Window::set_grapheme(): more than 1 grapheme");
+    bool wide = grapheme_width(s) == 2 && (x + 1 < w || !width_fixed);
+    release_wide(x, y, wide ? 2 : 1);
     // normalize to composed (which is actually a workaround for Windows)
-    u32string norm = unicode::to_nfc(s);
-    if (norm.size() > MAX_GRAPHEME_LENGTH)
-        throw runtime_error(
-            "Window::set_grapheme(): grapheme cluster too long");
-    grid[y][x].grapheme_length = norm.size();
-    norm.copy(grid[y][x].ch, norm.size());
+    assure_pos(x, y).set_grapheme(to_nfc(s));
+    if (wide) assure_pos(x + 1, y).set_char(Cell::WIDE_TAIL);
 }
 
 void Term::Window::set_char(size_t x, size_t y, char32_t c) {
     assure_pos(x, y);
-    grid[y][x].grapheme_length = 1;
-    grid[y][x].ch[0] = c;
+    bool wide = char_width(c) == 2 && (x + 1 < w || !width_fixed);
+    release_wide(x, y, wide ? 2 : 1);
+    assure_pos(x, y).set_char(c);
+    if (wide) assure_pos(x + 1, y).set_char(Cell::WIDE_TAIL);
 }
 
 Term::FgColor Term::Window::get_fg(size_t x, size_t y) const {
-    if (y >= grid.size() || x >= grid[y].size() ||
-        grid[y][x].cell_fg.is_unspecified())
+    const Cell* cell = find_cell(x, y);
+    if (!cell || cell->cell_fg.is_unspecified())
         return default_fg;
-    return grid[y][x].cell_fg;
+    return cell->cell_fg;
 }
 
 void Term::Window::set_fg(size_t x, size_t y, FgColor c) {
-    assure_pos(x, y);
-    grid[y][x].cell_fg = c;
+    if (resolving_defaults && c.is_unspecified()) c = default_fg;
+    assure_pos(x, y).cell_fg = c;
 }
 
 void Term::Window::set_fg(size_t x, size_t y,
                           uint8_t r, uint8_t g, uint8_t b) {
-    assure_pos(x, y);
-    grid[y][x].cell_fg = FgColor(r, g, b);
+    assure_pos(x, y).cell_fg = FgColor(r, g, b);
 }
 
 
 Term::BgColor Term::Window::get_bg(size_t x, size_t y) const {
-    if (y >= grid.size() || x >= grid[y].size() ||
-        grid[y][x].cell_bg.is_unspecified())
+    const Cell* cell = find_cell(x, y);
+    if (!cell || cell->cell_bg.is_unspecified())
         return default_bg;
-    return grid[y][x].cell_bg;
+    return cell->cell_bg;
 }
 
 void Term::Window::set_bg(size_t x, size_t y, BgColor c) {
-    assure_pos(x, y);
-    grid[y][x].cell_bg = c;
+    if (resolving_defaults && c.is_unspecified()) c = default_bg;
+    assure_pos(x, y).cell_bg = c;
 }
 
 void Term::Window::set_bg(size_t x, size_t y,
                           uint8_t r, uint8_t g, uint8_t b) {
-    assure_pos(x, y);
-    grid[y][x].cell_bg = BgColor(r, g, b);
+    assure_pos(x, y).cell_bg = BgColor(r, g, b);
 }
 
 Term::style Term::Window::get_style(size_t x, size_t y) const {
-    if (y >= grid.size() || x >= grid[y].size() ||
-        grid[y][x].cell_style == style::unspecified)
+    const Cell* cell = find_cell(x, y);
+    if (!cell || cell->cell_style == style::unspecified)
         return default_style;
-    return grid[y][x].cell_style;
+    return cell->cell_style;
 }
 
 void Term::Window::set_style(size_t x, size_t y, style c) {
-    assure_pos(x, y);
-    grid[y][x].cell_style = c;
+    if (resolving_defaults && c == style::unspecified) c = default_style;
+    assure_pos(x, y).cell_style = c;
 }
 
 Term::Cell Term::Window::get_cell(size_t x, size_t y) const {
-    if (y < grid.size() && x < grid[y].size())
-        return grid[y][x];
+    const Cell* cell = find_cell(x, y);
+    if (cell)
+        return *cell;
     else return Cell(U' ', default_fg, default_bg, default_style);
 }
 
 void Term::Window::set_cell(size_t x, size_t y, const Term::Cell &c) {
-    assure_pos(x, y);
-    grid[y][x] = c;
+    Cell& cell = assure_pos(x, y);
+    cell = c;
+    resolve(cell);
 }
 
 vector<vector<Term::Cell>> Term::Window::get_grid() const {
-    return grid;
+    vector<SharedRow> shared = get_shared_grid();
+    vector<vector<Cell>> res(shared.size());
+    for (size_t y = 0; y != shared.size(); ++y) {
+        if (shared[y].get()) res[y] = *shared[y].get();
+    }
+    return res;
 }
 
 void Term::Window::set_grid(const vector<vector<Term::Cell>> &new_grid) {
+    vector<SharedRow> shared;
+    shared.reserve(new_grid.size());
+    for (const vector<Cell>& row : new_grid) {
+        shared.emplace_back(row);
+    }
+    set_grid(shared);
+}
+
+vector<Term::SharedRow> Term::Window::get_shared_grid() const {
+    vector<SharedRow> res;
+    copy_rect(0, 0, w, h, res);
+    return res;
+}
+
+void Term::Window::set_grid(const vector<SharedRow> &new_grid) {
     grid = new_grid;
     if (grid.size() > h) {
         if (height_fixed) grid.resize(h);
         else h = grid.size();
     }
-    for (vector<Cell> &row : grid) {
+    for (SharedRow &row : grid) {
         if (row.size() > w) {
-            if (width_fixed) row.resize(w);
+            if (width_fixed) row.modify().resize(w);
             else w = row.size();
         }
     }
+    if (resolving_defaults) resolve_stored_cells();
 }
 
 void Term::Window::copy_grid_from(const Term::Window & win) {
-    set_grid(win.get_grid());
+    set_grid(win.get_shared_grid());
 }
 
 Term::FgColor Term::Window::get_default_fg() const {
@@ -691,6 +1266,16 @@ void Term::Window::set_wordwrap(bool ww) {
     wordwrap = ww;
 }
 
+bool Term::Window::is_resolving_defaults() const {
+    return resolving_defaults;
+}
+
+void Term::Window::set_resolving_defaults(bool resolve) {
+    if (resolve == resolving_defaults) return;
+    resolving_defaults = resolve;
+    if (resolving_defaults) resolve_stored_cells();
+}
+
 size_t Term::Window::write(const u32string& s,
                            FgColor a_fg,
                            BgColor a_bg,
@@ -707,6 +1292,29 @@ size_t Term::Window::write(const string& s,
     return simple_write(s, a_fg, a_bg, a_style);
 }
 
+size_t Term::Window::write(const u32string& s, const vector<TextRun>& runs) {
+    if (wordwrap && width_fixed)
+        return write_wordwrap(s, runs.data(), runs.size());
+    return simple_write(s.data(), s.size(), runs.data(), runs.size(), 0);
+}
+
+size_t Term::Window::write(const string& s, const vector<TextRun>& runs) {
+    // Decode run by run, so that the offsets can be converted on the way
+    u32string s32;
+    s32.reserve(s.size());
+    vector<TextRun> runs32(runs);
+    size_t pos = 0;
+    for (TextRun& run : runs32) {
+        size_t offset = min(max(run.offset, pos), s.size());
+        utf8_decode(s.data() + pos, offset - pos, s32);
+        pos = offset;
+        run.offset = s32.size();
+    }
+    utf8_decode(s.data() + pos, s.size() - pos, s32);
+    size_t i = write(s32, runs32);
+    return utf8_length(s32.data(), i);
+}
+
 size_t Term::Window::write(char32_t ch,
                            FgColor a_fg,
                            BgColor a_bg,
@@ -714,6 +1322,463 @@ size_t Term::Window::write(char32_t ch,
     return simple_write(ch, a_fg, a_bg, a_style);
 }
 
+void Term::Window::write_ansi(const char* s, size_t n) {
+    using Term::Key;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    size_t i = 0;
+    while (i != n) {
+        const unsigned char c = p[i];
+        switch (ansi.mode) {
+        case AnsiState::GROUND:
+            if (ansi.need) {
+                if (c >= ansi.lo && c <= ansi.hi) {
+                    ++i;
+                    ansi.cp = (ansi.cp << 6) | (c & 0x3f);
+                    ansi.lo = 0x80;
+                    ansi.hi = 0xbf;
+                    if (!--ansi.need) ansi_print(ansi.cp);
+                    continue;
+                }
+                // an incomplete sequence: look at c again
+                ansi.need = 0;
+                ansi_print(U'\xfffd');
+                continue;
+            }
+            if (c >= 0x20 && c < 0x7f) {
+                // the common case: a run of printable ASCII
+                size_t j = i + 1;
+                while (j != n && p[j] >= 0x20 && p[j] < 0x7f) ++j;
+                ansi_print(s + i, j - i);
+                i = j;
+                continue;
+            }
+            ++i;
+            if (c >= 0x80) {
+                // the lead byte of a UTF-8 sequence, which determines the
+                // range of the following byte (no overlong forms, no
+                // surrogates, nothing beyond U+10FFFF)
+                if (c >= 0xc2 && c <= 0xdf) {
+                    ansi.need = 1;
+                    ansi.cp = c & 0x1f;
+                } else if (c >= 0xe0 && c <= 0xef) {
+                    ansi.need = 2;
+                    ansi.cp = c & 0x0f;
+                    ansi.lo = (c == 0xe0 ? 0xa0 : 0x80);
+                    ansi.hi = (c == 0xed ? 0x9f : 0xbf);
+                } else if (c >= 0xf0 && c <= 0xf4) {
+                    ansi.need = 3;
+                    ansi.cp = c & 0x07;
+                    ansi.lo = (c == 0xf0 ? 0x90 : 0x80);
+                    ansi.hi = (c == 0xf4 ? 0x8f : 0xbf);
+                } else {
+                    ansi_print(U'\xfffd');
+                }
+                continue;
+            }
+            switch (c) {
+            case Key::ESC:
+                ansi.mode = AnsiState::ESCAPE;
+                ansi.intermediate = 0;
+                break;
+            case Key::CR:
+                cursor.x = 0;
+                ansi.wrap_pending = false;
+                ansi.cluster_len = 0;
+                break;
+            case Key::LF:
+            case 0x0b: // VT
+            case 0x0c: // FF
+                if (ansi_lf_returns) {
+                    ansi_newline();
+                } else {
+                    size_t x = cursor.x;
+                    ansi_newline();
+                    cursor.x = x;
+                }
+                break;
+            case Key::BACKSPACE:
+                if (ansi.wrap_pending) ansi.wrap_pending = false;
+                else if (cursor.x) --cursor.x;
+                ansi.cluster_len = 0;
+                break;
+            case Key::TAB:
+                if (tabsize && !ansi.wrap_pending) {
+                    cursor.x = (cursor.x / tabsize + 1) * tabsize;
+                    if (cursor.x >= w) cursor.x = (w ? w - 1 : 0);
+                }
+                ansi.cluster_len = 0;
+                break;
+            default: // BEL and the like
+                break;
+            }
+            continue;
+        case AnsiState::ESCAPE:
+            ++i;
+            if (c == '[') {
+                ansi.mode = AnsiState::CSI;
+                ansi.params[0] = 0;
+                ansi.param_count = 0;
+                ansi.colons = 0;
+                ansi.private_csi = false;
+                ansi.prefix = 0;
+            } else if (c == ']' || c == 'P' || c == 'X' || c == '^' ||
+                       c == '_') {
+                // OSC, DCS, SOS, PM, APC: a string up to ST or BEL
+                ansi.mode = AnsiState::STRING;
+            } else if (c >= 0x20 && c <= 0x2f) {
+                // intermediate bytes keep the sequence going
+                ansi.intermediate = static_cast<char>(c);
+            } else {
+                ansi.mode = AnsiState::GROUND;
+                if (c >= 0x30 && c <= 0x7e) ansi_esc(static_cast<char>(c));
+            }
+            continue;
+        case AnsiState::CSI:
+            ++i;
+            if (c >= '0' && c <= '9') {
+                if (!ansi.param_count) ansi.param_count = 1;
+                if (ansi.param_count <= AnsiState::MAX_PARAMS) {
+                    uint16_t& param = ansi.params[ansi.param_count - 1];
+                    param = static_cast<uint16_t>(
+                        min(param * 10u + (c - '0'), 0xffffu));
+                }
+            } else if (c == ';' || c == ':') {
+                if (!ansi.param_count) ansi.param_count = 1;
+                // beyond MAX_PARAMS, parameters are dropped
+                if (ansi.param_count < AnsiState::MAX_PARAMS) {
+                    if (c == ':') ansi.colons |= 1u << ansi.param_count;
+                    ansi.params[ansi.param_count] = 0;
+                }
+                if (ansi.param_count <= AnsiState::MAX_PARAMS)
+                    ++ansi.param_count;
+            } else if (c >= 0x20 && c <= 0x3f) {
+                // private parameters (<, =, >, ?) and intermediate bytes
+                if (c >= 0x3c && !ansi.param_count && !ansi.private_csi)
+                    ansi.prefix = static_cast<char>(c);
+                else if (c <= 0x2f)
+                    ansi.intermediate = static_cast<char>(c);
+                ansi.private_csi = true;
+            } else if (c >= 0x40 && c <= 0x7e) {
+                ansi.mode = AnsiState::GROUND;
+                ansi_csi(static_cast<char>(c));
+            } else if (c == Key::ESC) {
+                ansi.mode = AnsiState::ESCAPE;
+                ansi.intermediate = 0;
+            }
+            continue;
+        case AnsiState::STRING:
+            ++i;
+            if (c == 0x07) ansi.mode = AnsiState::GROUND;
+            else if (c == Key::ESC) ansi.mode = AnsiState::STRING_ESCAPE;
+            continue;
+        case AnsiState::STRING_ESCAPE:
+            // ST is ESC backslash. Any other escape sequence ends the string
+            // as well, and is processed as such.
+            if (c == '\\') {
+                ++i;
+                ansi.mode = AnsiState::GROUND;
+            } else {
+                ansi.mode = AnsiState::ESCAPE;
+                ansi.intermediate = 0;
+            }
+            continue;
+        }
+    }
+}
+
+void Term::Window::write_ansi(const string& s) {
+    write_ansi(s.data(), s.size());
+}
+
+void Term::Window::reset_ansi() {
+    ansi = AnsiState();
+}
+
+void Term::Window::ansi_print(const char* s, size_t n) {
+    if ((width_fixed && !w) || (height_fixed && !h)) return;
+    const Cell cell(U' ',
+                    ansi.sgr_fg.is_unspecified() ? default_fg : ansi.sgr_fg,
+                    ansi.sgr_bg.is_unspecified() ? default_bg : ansi.sgr_bg,
+                    ansi.sgr_style == style::unspecified ? default_style
+                                                         : ansi.sgr_style);
+    // The cells are prepared here and stored in one go per row. Mostly,
+    // only the graphemes need to be filled in, as the attributes are the
+    // same as before.
+    enum { CHUNK = 256 };
+    static thread_local vector<Cell> buffer(CHUNK);
+    static thread_local size_t buffer_ready = 0;
+    if (buffer_ready && (buffer[0].cell_fg != cell.cell_fg ||
+                         buffer[0].cell_bg != cell.cell_bg ||
+                         buffer[0].cell_style != cell.cell_style)) {
+        buffer_ready = 0;
+    }
+    while (n) {
+        if (ansi.wrap_pending || (width_fixed && cursor.x >= w))
+            ansi_newline();
+        if (cursor.y >= h) set_h(cursor.y + 1); // the height is not fixed
+        size_t x = cursor.x;
+        size_t k = min(n, size_t(CHUNK));
+        if (width_fixed) k = min(k, w - x);
+        for (; buffer_ready < k; ++buffer_ready) {
+            buffer[buffer_ready] = cell;
+        }
+        for (size_t j = 0; j != k; ++j) {
+            buffer[j].grapheme = static_cast<unsigned char>(s[j]);
+        }
+        release_wide(x, cursor.y, k);
+        store_cells(x, cursor.y, buffer.data(), k);
+        s += k;
+        n -= k;
+        x += k;
+        ansi.cluster[0] = static_cast<unsigned char>(s[-1]);
+        ansi.cluster_len = 1;
+        ansi.cluster_x = x - 1;
+        ansi.cluster_y = cursor.y;
+        if (x < w) {
+            cursor.x = x;
+        } else if (width_fixed) {
+            cursor.x = w - 1;
+            ansi.wrap_pending = true;
+        } else {
+            w = x + 1;
+            cursor.x = x;
+        }
+    }
+}
+
+void Term::Window::ansi_print(char32_t c) {
+    if (c >= 0x80 && c < 0xa0) return; // C1 controls
+    if ((width_fixed && !w) || (height_fixed && !h)) return;
+    // a codepoint which continues the cluster printed before (e.g. a
+    // combining mark, possibly from the next chunk) goes into its cell
+    if (ansi.cluster_len && ansi.cluster_len < AnsiState::MAX_CLUSTER) {
+        ansi.cluster[ansi.cluster_len] = c;
+        if (grapheme_length(ansi.cluster, ansi.cluster_len + 1u) ==
+            ansi.cluster_len + 1u) {
+            ++ansi.cluster_len;
+            if (find_cell(ansi.cluster_x, ansi.cluster_y)) {
+                access_cell(ansi.cluster_x, ansi.cluster_y)
+                    .set_grapheme(to_nfc(u32string(ansi.cluster,
+                                                   ansi.cluster_len)));
+            }
+            return;
+        }
+    }
+    size_t cells = grapheme_width(&c, 1);
+    if (cells == 2 && width_fixed && w < 2) cells = 1;
+    if (ansi.wrap_pending || (width_fixed && cursor.x + cells > w))
+        ansi_newline();
+    if (cursor.y >= h) set_h(cursor.y + 1); // the height is not fixed
+    FgColor a_fg = ansi.sgr_fg.is_unspecified() ? default_fg : ansi.sgr_fg;
+    BgColor a_bg = ansi.sgr_bg.is_unspecified() ? default_bg : ansi.sgr_bg;
+    style a_style = (ansi.sgr_style == style::unspecified ? default_style
+                                                          : ansi.sgr_style);
+    Cell pair[2] = {Cell(U'\0', a_fg, a_bg, a_style),
+                    Cell(Cell::WIDE_TAIL, a_fg, a_bg, a_style)};
+    // normalize to composed, just like set_grapheme()
+    pair[0].set_grapheme(to_nfc(u32string(1, c)));
+    release_wide(cursor.x, cursor.y, cells);
+    store_cells(cursor.x, cursor.y, pair, cells);
+    ansi.cluster[0] = c;
+    ansi.cluster_len = 1;
+    ansi.cluster_x = cursor.x;
+    ansi.cluster_y = cursor.y;
+    size_t x = cursor.x + cells;
+    if (x < w) {
+        cursor.x = x;
+    } else if (width_fixed) {
+        cursor.x = w - 1;
+        ansi.wrap_pending = true;
+    } else {
+        w = x + 1;
+        cursor.x = x;
+    }
+}
+
+void Term::Window::ansi_newline() {
+    cursor.x = 0;
+    ansi.wrap_pending = false;
+    ansi.cluster_len = 0;
+    if (!height_fixed) {
+        ++cursor.y;
+        if (cursor.y >= h) set_h(cursor.y + 1);
+    } else if (cursor.y + 1 < h) {
+        ++cursor.y;
+    } else if (h) {
+        scroll_rows(1);
+    }
+}
+
+void Term::Window::ansi_erase(size_t y, size_t x0, size_t x1) {
+    x1 = min(x1, w);
+    if (y >= h || x0 >= x1) return;
+    if (x0 == 0 && x1 == w) {
+        clear_row(y);
+        return;
+    }
+    for (size_t x = x0; x != x1; ++x) {
+        if (find_cell(x, y)) access_cell(x, y) = get_blank_cell();
+    }
+}
+
+void Term::Window::ansi_csi(char final_byte) {
+    if (ansi.private_csi) return;
+    const size_t count = min(size_t(ansi.param_count),
+                             size_t(AnsiState::MAX_PARAMS));
+    // parameter i, where 0 (or none) stands for the default value
+    auto param = [&](size_t i, size_t def) -> size_t {
+        return (i < count && ansi.params[i]) ? ansi.params[i] : def;
+    };
+    const size_t max_x = (w ? w - 1 : 0);
+    const size_t max_y = (h ? h - 1 : 0);
+    switch (final_byte) {
+    case 'm':
+        ansi_sgr();
+        return;
+    case 'A':
+        cursor.y -= min(cursor.y, param(0, 1));
+        break;
+    case 'B':
+        cursor.y = min(cursor.y + param(0, 1), max_y);
+        break;
+    case 'C':
+        cursor.x = min(cursor.x + param(0, 1), max_x);
+        break;
+    case 'D':
+        cursor.x -= min(cursor.x, param(0, 1));
+        break;
+    case 'G':
+        cursor.x = min(param(0, 1) - 1, max_x);
+        break;
+    case 'H':
+    case 'f':
+        cursor.y = min(param(0, 1) - 1, max_y);
+        cursor.x = min(param(1, 1) - 1, max_x);
+        break;
+    case 'J': {
+        size_t mode = param(0, 0);
+        if (mode == 0) {
+            ansi_erase(cursor.y, cursor.x, w);
+            for (size_t y = cursor.y + 1; y < h; ++y) clear_row(y);
+        } else if (mode == 1) {
+            for (size_t y = 0; y < cursor.y; ++y) clear_row(y);
+            ansi_erase(cursor.y, 0, cursor.x + 1);
+        } else {
+            for (size_t y = 0; y < h; ++y) clear_row(y);
+        }
+        break;
+    }
+    case 'K': {
+        size_t mode = param(0, 0);
+        if (mode == 0) ansi_erase(cursor.y, cursor.x, w);
+        else if (mode == 1) ansi_erase(cursor.y, 0, cursor.x + 1);
+        else ansi_erase(cursor.y, 0, w);
+        break;
+    }
+    default:
+        return;
+    }
+    ansi.wrap_pending = false;
+    ansi.cluster_len = 0;
+}
+
+void Term::Window::ansi_esc(char) {}
+
+void Term::Window::ansi_sgr() {
+    const size_t count = min(size_t(ansi.param_count),
+                             size_t(AnsiState::MAX_PARAMS));
+    const uint16_t* params = ansi.params;
+    auto is_sub = [&](size_t i) {
+        return i < count && ((ansi.colons >> i) & 1);
+    };
+    if (!count) {
+        // CSI m is CSI 0 m
+        ansi.sgr_fg = fg::unspecified;
+        ansi.sgr_bg = bg::unspecified;
+        ansi.sgr_style = style::unspecified;
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned code = params[i];
+        // the sub-parameters of code, if separated by ':'
+        size_t last = i;
+        while (is_sub(last + 1)) ++last;
+        if (code == 38 || code == 48 || code == 58) {
+            // extended color: 5;index or 2;r;g;b. With ':', a color space
+            // id may precede r, g and b.
+            size_t j = i + 1;
+            const bool colon = is_sub(j);
+            size_t end = (colon ? last + 1 : count);
+            if (j >= end) break;
+            bool valid = false;
+            uint8_t r = 0, g = 0, b = 0;
+            unsigned index = 256;
+            if (params[j] == 5 && j + 1 < end) {
+                index = params[j + 1];
+                valid = (index < 256);
+                i = j + 1;
+            } else if (params[j] == 2 && j + 3 < end) {
+                size_t k = (colon && j + 4 < end ? j + 2 : j + 1);
+                r = static_cast<uint8_t>(min(params[k], uint16_t(255)));
+                g = static_cast<uint8_t>(min(params[k + 1], uint16_t(255)));
+                b = static_cast<uint8_t>(min(params[k + 2], uint16_t(255)));
+                valid = true;
+                i = k + 2;
+            } else {
+                i = j;
+            }
+            if (colon) i = last;
+            if (!valid || code == 58) continue; // no underline colors
+            if (index < 16) {
+                // the basic colors are rendered as such
+                unsigned base = (index < 8 ? 30 + index : 90 + index - 8);
+                if (code == 38) ansi.sgr_fg = static_cast<fg>(base);
+                else ansi.sgr_bg = static_cast<bg>(base + 10);
+                continue;
+            }
+            if (index < 256) palette_rgb(uint8_t(index), r, g, b);
+            if (code == 38) ansi.sgr_fg = FgColor(r, g, b);
+            else ansi.sgr_bg = BgColor(r, g, b);
+            continue;
+        }
+        i = last;
+        if (code == 0) {
+            ansi.sgr_fg = fg::unspecified;
+            ansi.sgr_bg = bg::unspecified;
+            ansi.sgr_style = style::unspecified;
+        } else if ((code >= 1 && code <= 9) || code == 53) {
+            // a cell has a single style: the last one set wins
+            ansi.sgr_style = static_cast<style>(code);
+        } else if ((code >= 21 && code <= 29) || code == 55) {
+            // turns off the styles given
+            const style st = ansi.sgr_style;
+            bool off = false;
+            switch (code) {
+            case 22: off = (st == style::bold || st == style::dim); break;
+            case 23: off = (st == style::italic); break;
+            case 21:
+            case 24: off = (st == style::underline); break;
+            case 25: off = (st == style::blink ||
+                            st == style::blink_rapid); break;
+            case 27: off = (st == style::reversed); break;
+            case 28: off = (st == style::conceal); break;
+            case 29: off = (st == style::crossed); break;
+            case 55: off = (st == style::overline); break;
+            }
+            if (off) ansi.sgr_style = style::unspecified;
+        } else if ((code >= 30 && code <= 37) || (code >= 90 && code <= 97)) {
+            ansi.sgr_fg = static_cast<fg>(code);
+        } else if (code == 39) {
+            ansi.sgr_fg = fg::unspecified;
+        } else if ((code >= 40 && code <= 47) ||
+                   (code >= 100 && code <= 107)) {
+            ansi.sgr_bg = static_cast<bg>(code);
+        } else if (code == 49) {
+            ansi.sgr_bg = bg::unspecified;
+        }
+    }
+}
+
 void Term::Window::fill_fg(size_t x1, size_t y1,
                            size_t width, size_t height, FgColor color) {
     if (color == fg::unspecified) color = default_fg;
@@ -820,8 +1885,8 @@ void Term::Window::print_rect(
 }
 
 void Term::Window::clear_row(size_t y) {
-    if (y < grid.size()) {
-        grid[y].clear();
+    if (find_row(y)) {
+        access_row(y).clear();
     }
 }
 
@@ -841,10 +1906,9 @@ Term::Window Term::Window::cutout(size_t x0, size_t y0,
                                   size_t width, size_t height) const {
     // TODO what about the children?
     Window cropped(width, height);
-    for (size_t y = 0; y != height && y0 + y < h; ++y) {
-        for (size_t x = 0; x != width && x0 + x < grid[y0 + y].size(); ++x) {
-            cropped.grid[y].push_back(grid[y0 + y][x0 + x]);
-        }
+    if (y0 < h) {
+        copy_rect(x0, y0, width, min(height, h - y0), cropped.grid);
+        cropped.grid.resize(height);
     }
     // preserve cursor if within cut-out
     if (cursor.x < x0 || cursor.x >= x0 + width || cursor.y < y0
@@ -857,6 +1921,10 @@ Term::Window Term::Window::cutout(size_t x0, size_t y0,
         //if (is_cursor_visible()) cropped.show_cursor();
         //else cropped.hide_cursor();
     }
+    // the cell set_cursor() may have created is resolved against our
+    // defaults, as are the others
+    if (resolving_defaults)
+        resolve(cropped.access_cell(cropped.cursor.x, cropped.cursor.y));
     return cropped;
 }
 
@@ -935,7 +2003,15 @@ Term::Cursor Term::Window::get_visual_cursor() const {
     if (!cwin->is_visible() || !cwin->cursor.is_visible) {
         return Cursor(0, 0, false);
     }
-    Cursor cur(cwin->cursor.x, cwin->cursor.y, false);
+    // cursor scrolled out of the frame?
+    if (cwin->cursor.x < cwin->scroll_x || cwin->cursor.y < cwin->scroll_y) {
+        return Cursor(0, 0, false);
+    }
+    Cursor cur(cwin->cursor.x - cwin->scroll_x,
+               cwin->cursor.y - cwin->scroll_y, false);
+    if (cwin->framed && (cur.x >= cwin->frame_w || cur.y >= cwin->frame_h)) {
+        return Cursor(0, 0, false);
+    }
     // cursor obscured by a child's own child?
     for (ChildWindow* gcwin : cwin->children) {
         if (!gcwin->visible) {
@@ -943,9 +2019,9 @@ Term::Cursor Term::Window::get_visual_cursor() const {
         }
         size_t b = (gcwin->border == border_t::NO_BORDER ? 0 : 1);
         if (cur.x + b >= gcwin->offset_x && 
-            cur.x < gcwin->offset_x + gcwin->w + b &&
+            cur.x < gcwin->offset_x + gcwin->get_frame_w() + b &&
             cur.y + b >= gcwin->offset_y && 
-            cur.y < gcwin->offset_y + gcwin->h + b) {
+            cur.y < gcwin->offset_y + gcwin->get_frame_h() + b) {
             return Cursor(0, 0, false);
         }
     }
@@ -953,7 +2029,7 @@ Term::Cursor Term::Window::get_visual_cursor() const {
     cur.y += cwin->offset_y;
     // cursor within parent window?
     Window* pwin = cwin->get_parent();
-    if (cur.x >= pwin->w || cur.y >= pwin->h) {
+    if (cur.x >= frame_w_of(pwin) || cur.y >= frame_h_of(pwin)) {
         return Cursor(0, 0, false);
     }
     // pass cursor on to base window
@@ -962,7 +2038,8 @@ Term::Cursor Term::Window::get_visual_cursor() const {
         pwin = cwin->get_parent();
         cur.x += cwin->offset_x;
         cur.y += cwin->offset_y;
-        if (!cwin->is_visible() || cur.x >= pwin->w || cur.y >= pwin->h) {
+        if (!cwin->is_visible() || cur.x >= frame_w_of(pwin) ||
+            cur.y >= frame_h_of(pwin)) {
             return Cursor(0, 0, false);
         }
     }
@@ -981,9 +2058,9 @@ Term::Cursor Term::Window::get_visual_cursor() const {
         }
         size_t b = (cwin2->border == border_t::NO_BORDER ? 0 : 1);
         if (cur.x + b >= cwin2->offset_x &&
-            cur.x < cwin2->offset_x + cwin2->w + b &&
+            cur.x < cwin2->offset_x + cwin2->get_frame_w() + b &&
             cur.y + b >= cwin2->offset_y &&
-            cur.y < cwin2->offset_y + cwin2->h + b) {
+            cur.y < cwin2->offset_y + cwin2->get_frame_h() + b) {
             cur.is_visible = false;
             return cur;
         }
@@ -1010,25 +2087,41 @@ Term::ChildWindow::ChildWindow(Window *ptr,
 {}
 
 void Term::ChildWindow::merge_into_grid(Window *win,
-                                        size_t parent_offset_x,
-                                        size_t parent_offset_y,
+                                        ptrdiff_t parent_offset_x,
+                                        ptrdiff_t parent_offset_y,
                                         size_t parent_w,
                                         size_t parent_h) const {
     if (!visible || !parent_w || !parent_h) return;
-    size_t acc_offset_x = parent_offset_x + offset_x;
-    size_t acc_offset_y = parent_offset_y + offset_y;
-    if (acc_offset_x > win->get_w() || acc_offset_y > win->get_h()) return;
-    for (size_t y = 0; y < h; ++y) {
-        size_t pos_y = acc_offset_y + y;
-        // subwindows outside the (parental) window do not throw an
-        // exception, but only the in-window parts are copied into the grid.
-        if (pos_y >= parent_offset_y + parent_h || pos_y >= win->get_h())
-            break;
-        for (size_t x = 0; x < w; ++x) {
-            size_t pos_x = acc_offset_x + x;
-            if (pos_x >= parent_offset_x + parent_w || pos_x >= win->get_w())
-                break;
-            win->set_cell(pos_x, pos_y, get_cell(x,y));
+    // Offsets are signed, as win may be a cut-out of the base window which
+    // starts to the right of or below the parent.
+    const ptrdiff_t win_w = static_cast<ptrdiff_t>(win->get_w());
+    const ptrdiff_t win_h = static_cast<ptrdiff_t>(win->get_h());
+    ptrdiff_t acc_offset_x = parent_offset_x + static_cast<ptrdiff_t>(offset_x);
+    ptrdiff_t acc_offset_y = parent_offset_y + static_cast<ptrdiff_t>(offset_y);
+    if (acc_offset_x > win_w || acc_offset_y > win_h) return;
+    const size_t fw = get_frame_w();
+    const size_t fh = get_frame_h();
+    // subwindows outside the (parental) window do not throw an
+    // exception, but only the in-window parts are copied into the grid.
+    const ptrdiff_t clip_x = min(parent_offset_x + (ptrdiff_t)parent_w, win_w);
+    const ptrdiff_t clip_y = min(parent_offset_y + (ptrdiff_t)parent_h, win_h);
+    // the content may have shrunk since scroll_to()
+    const size_t sx = min(scroll_x, w > fw ? w - fw : 0);
+    const size_t sy = min(scroll_y, h > fh ? h - fh : 0);
+    const Cell blank(U' ', default_fg, default_bg, default_style);
+    const size_t first_x = (acc_offset_x < 0 ? (size_t)-acc_offset_x : 0);
+    const size_t first_y = (acc_offset_y < 0 ? (size_t)-acc_offset_y : 0);
+    for (size_t y = first_y; y < fh; ++y) {
+        ptrdiff_t pos_y = acc_offset_y + (ptrdiff_t)y;
+        if (pos_y >= clip_y) break;
+        // only the visible slice of the content is copied
+        const vector<Cell>* row = find_row(sy + y);
+        for (size_t x = first_x; x < fw; ++x) {
+            ptrdiff_t pos_x = acc_offset_x + (ptrdiff_t)x;
+            if (pos_x >= clip_x) break;
+            win->set_cell(pos_x, pos_y,
+                          row && sx + x < row->size() ? (*row)[sx + x]
+                                                      : blank);
         }
     }
     // draw border:
@@ -1036,39 +2129,58 @@ void Term::ChildWindow::merge_into_grid(Window *win,
     //
     win->print_rect(
         // TODO include title right away?!
-        (int)acc_offset_x - 1, (int)acc_offset_y - 1, w + 2, h + 2,
-        border, border_fg, border_bg);
+        (int)acc_offset_x - 1, (int)acc_offset_y - 1, fw + 2, fh + 2,
+        border,
+        // unspecified colors are reset, whatever the defaults of win
+        border_fg.is_unspecified() ? FgColor(fg::reset) : border_fg,
+        border_bg.is_unspecified() ? BgColor(bg::reset) : border_bg);
     // process title
     if (!title.size()) return;
     // title row out of window?
-    if (acc_offset_y == 0 || acc_offset_y > win->get_h()) {
+    if (acc_offset_y < 1 || acc_offset_y > win_h) {
         return;
     }
+    size_t title_w = 0;
+    for (size_t i = 0; i < title.size();) {
+        size_t l = grapheme_length(title, i);
+        title_w += grapheme_width(title.data() + i, l);
+        i += l;
+    }
     // if enough space, surround title with blanks
-    size_t graph_count = unicode::grapheme_count(title);
-    bool blanks = (graph_count + 2 <= w);
-    // split the title into vector of at most w grapheme clusters
+    bool blanks = (title_w + 2 <= fw);
+    // split the title into grapheme clusters taking at most fw cells
     vector<u32string> title_gcv;
-    if (blanks) title_gcv.push_back(U" ");
-    size_t i = 0;
-    while (i < title.size() && title_gcv.size() != w) {
-        size_t l = unicode::grapheme_length(title.data() + i);
+    size_t used = 0;
+    if (blanks) {
+        title_gcv.push_back(U" ");
+        ++used;
+    }
+    for (size_t i = 0; i < title.size();) {
+        size_t l = grapheme_length(title, i);
+        size_t gw = grapheme_width(title.data() + i, l);
+        if (used + gw > fw) break;
         title_gcv.push_back(title.substr(i, l));
+        used += gw;
         i += l;
     }
-    if (blanks) title_gcv.push_back(U" ");
+    if (blanks) {
+        title_gcv.push_back(U" ");
+        ++used;
+    }
     // center title
-    size_t x0 = acc_offset_x + (w - title_gcv.size()) / 2;
+    ptrdiff_t pos_x = acc_offset_x + (ptrdiff_t)(fw - used) / 2;
     // print title
-    for (size_t i = 0; i != title_gcv.size() && x0 + i < win->get_w(); ++i) {
+    for (const u32string& g : title_gcv) {
+        if (pos_x >= win_w) break;
         // color has already been set by printing border
-        win->set_grapheme(x0 + i, acc_offset_y - 1, title_gcv[i]);
+        if (pos_x >= 0) win->set_grapheme(pos_x, acc_offset_y - 1, g);
+        pos_x += (ptrdiff_t)grapheme_width(g);
     }
     // repeat merge_into_grid() recursively with own children
     for (const auto child : children) {
         child->merge_into_grid(win, acc_offset_x, acc_offset_y,
-            min(w, win->get_w() - acc_offset_x),
-            min(h, win->get_h() - acc_offset_y));
+            min<ptrdiff_t>(fw, win_w - acc_offset_x),
+            min<ptrdiff_t>(fh, win_h - acc_offset_y));
     }
 }
 
@@ -1086,9 +2198,9 @@ bool Term::ChildWindow::is_inside_parent(bool strict) const {
     }
     if (offset_x < b || offset_y < b)
         return false;
-    if (offset_x + w + b > parent->get_w())
+    if (offset_x + get_frame_w() + b > frame_w_of(parent))
         return false;
-    if (offset_y + h + b > parent->get_h())
+    if (offset_y + get_frame_h() + b > frame_h_of(parent))
         return false;
     return true;
 }
@@ -1106,13 +2218,13 @@ pair<size_t, size_t> Term::ChildWindow::move_to(size_t x, size_t y) {
     if (x < border_width) {
         offset_x = border_width;
     } else {
-        size_t max_x = parent->get_w() - w - border_width;
+        size_t max_x = frame_w_of(parent) - get_frame_w() - border_width;
         offset_x = min(x, max_x);
     }
     if (y < border_width) {
         offset_y = border_width;
     } else {
-        size_t max_y = parent->get_h() - h - border_width;
+        size_t max_y = frame_h_of(parent) - get_frame_h() - border_width;
         offset_y = min(y, max_y);
     }
     return make_pair(offset_x, offset_y);
@@ -1123,7 +2235,7 @@ std::u32string Term::ChildWindow::get_title() const {
 }
 
 void Term::ChildWindow::set_title(const std::string& s) {
-    set_title(unicode::utf8::decode(s));
+    set_title(utf8_decode(s));
 }
 
 void Term::ChildWindow::set_title(const std::u32string& s) {
@@ -1177,3 +2289,42 @@ void Term::ChildWindow::to_background() {
     parent->child_to_background(this);
 }
 
+
+void Term::ChildWindow::set_frame(size_t width, size_t height) {
+    framed = true;
+    frame_w = width;
+    frame_h = height;
+    scroll_to(scroll_x, scroll_y);
+}
+
+void Term::ChildWindow::reset_frame() {
+    framed = false;
+    scroll_x = 0;
+    scroll_y = 0;
+}
+
+bool Term::ChildWindow::is_framed() const {
+    return framed;
+}
+
+size_t Term::ChildWindow::get_frame_w() const {
+    return framed ? frame_w : w;
+}
+
+size_t Term::ChildWindow::get_frame_h() const {
+    return framed ? frame_h : h;
+}
+
+void Term::ChildWindow::scroll_to(size_t x, size_t y) {
+    if (!framed) return;
+    scroll_x = min(x, w > frame_w ? w - frame_w : 0);
+    scroll_y = min(y, h > frame_h ? h - frame_h : 0);
+}
+
+size_t Term::ChildWindow::get_scroll_x() const {
+    return scroll_x;
+}
+
+size_t Term::ChildWindow::get_scroll_y() const {
+    return scroll_y;
+}
@@ -2,13 +2,15 @@
 
 #include "base.hpp"
 #include "input.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace Term {
 
-enum { MAX_GRAPHEME_LENGTH = 4 };
-
 enum class border_t {
     NO_BORDER,
     BLANK,
@@ -70,22 +72,91 @@ public :
     bool is_unspecified() const override;
 };
 
+/* The grapheme clusters of more than one codepoint which have been put into
+ * a cell so far, each stored once. A cell refers to such a cluster by its
+ * index, so that clusters of any length fit into a cell. Entries are never
+ * removed, as any cell (or a copy of it) might still refer to them. The
+ * pool is bounded instead: once it holds get_capacity() clusters, further
+ * ones are not added, and cells show them as U+FFFD. The pool is shared by
+ * all windows and may be used from several threads.
+ */
+class GraphemePool {
+   public :
+    // returned by intern() if s is not present and the pool is full
+    static constexpr uint32_t FULL = 0xffffffff;
+    // returns the index of s, adding it if not yet present
+    static uint32_t intern(const std::u32string& s);
+    // The reference remains valid, as entries are never moved
+    static const std::u32string& get(uint32_t index);
+    static size_t size();
+    // the number of clusters the pool holds at most, by default 1 << 16.
+    // Lowering it keeps the clusters added already.
+    static size_t get_capacity();
+    static void set_capacity(size_t);
+};
+
 /* Represents a cell in the terminal window, holding the character (i.e., the
  * Unicode grapheme cluster), the foreground and background colors and the 
  * style of this specific cell.
  */
 struct Cell {
+    // flags the grapheme as index into the GraphemePool. Codepoints never
+    // reach this bit.
+    static constexpr char32_t POOLED = 0x80000000;
+    // marks the right half of a wide grapheme, i.e. the cell covered by the
+    // grapheme in the cell to the left. Not a codepoint either.
+    static constexpr char32_t WIDE_TAIL = 0x110000;
+
 	FgColor cell_fg;
 	BgColor cell_bg;
 	style cell_style;
-    uint8_t grapheme_length;
-    char32_t ch[MAX_GRAPHEME_LENGTH];
+    // a single codepoint (U'\0' if empty), or POOLED | pool index
+    char32_t grapheme;
     
     Cell();
     Cell(char32_t);
     Cell(const std::u32string&);
     Cell(char32_t, FgColor, BgColor, style);
     Cell(const std::u32string&, FgColor, BgColor, style);
+
+    bool is_empty() const;
+    bool is_wide_tail() const;
+    size_t get_grapheme_length() const; // in codepoints
+    size_t get_width() const; // in cells, 1 or 2
+    std::u32string get_grapheme() const;
+    // s must be a single grapheme cluster; it is neither checked nor
+    // normalized here
+    void set_grapheme(const std::u32string& s);
+    void set_char(char32_t);
+    // appends the grapheme to out (nothing if empty or WIDE_TAIL)
+    void append_grapheme(std::u32string& out) const;
+
+    // equal graphemes have equal ids, so comparing them is an integer compare
+    bool operator==(const Cell&) const;
+    bool operator!=(const Cell&) const;
+};
+
+/* A row of cells, shared by copies of it (e.g. in snapshots or cut-outs of
+ * a window) until one of them is modified: copy-on-write. Copying a
+ * SharedRow thus only copies a pointer. As the reference count is atomic,
+ * a copy may be handed over to another thread (e.g. for rendering), while
+ * the original is modified further.
+ */
+class SharedRow {
+    std::shared_ptr<std::vector<Cell>> cells;
+
+   public :
+    SharedRow() = default;
+    explicit SharedRow(std::vector<Cell>);
+
+    size_t size() const;
+    // nullptr if the row has no cells (yet)
+    const std::vector<Cell>* get() const;
+    // for writing. Clones the cells first if they are shared.
+    std::vector<Cell>& modify();
+    // removes all cells, keeping the memory if not shared
+    void clear();
+    bool is_shared() const;
 };
 
 struct Cursor {
@@ -96,6 +167,19 @@ struct Cursor {
     Cursor(size_t x_, size_t y_, bool v_) : x(x_), y(y_), is_visible(v_) {}
 };
 
+// The attributes of a run of text, from offset (in codepoints) up to the
+// offset of the next run. Unspecified attributes are taken from the
+// window's defaults.
+struct TextRun {
+    size_t offset{};
+    FgColor fg;
+    BgColor bg;
+    style st{};
+    TextRun(size_t offset_ = 0, FgColor fg_ = fg::unspecified,
+            BgColor bg_ = bg::unspecified, style st_ = style::unspecified)
+        : offset(offset_), fg(fg_), bg(bg_), st(st_) {}
+};
+
 class ChildWindow; // forward declaration
 
 /* Represents a rectangular window, as a 2D array of characters and their 
@@ -115,7 +199,9 @@ class Window {
     FgColor default_fg;
     BgColor default_bg;
     style default_style{};
-    std::vector<std::vector<Cell>> grid; // the cells (grid[0] is top row)
+    // see set_resolving_defaults()
+    bool resolving_defaults{};
+    std::vector<SharedRow> grid; // the cells (grid[0] is top row)
     std::vector<ChildWindow*> children;
     Window* visual_cursor_holder{}; // default: this
 
@@ -129,9 +215,90 @@ class Window {
     // one whitespace character:
     bool skip_whitespace_at_eol = true;
 
+    // The state of write_ansi() between calls, so that escape sequences and
+    // UTF-8 sequences may be split across chunks
+    struct AnsiState {
+        enum : uint8_t { GROUND, ESCAPE, CSI, STRING, STRING_ESCAPE } mode{};
+        // an incomplete UTF-8 sequence
+        char32_t cp{};
+        uint8_t need{};              // continuation bytes missing
+        uint8_t lo{0x80}, hi{0xbf};  // range of the next continuation byte
+        // the parameters of a CSI sequence
+        enum { MAX_PARAMS = 16 };
+        uint16_t params[MAX_PARAMS]{};
+        uint32_t colons{};           // bit i: params[i] follows a ':'
+        uint8_t param_count{};
+        bool private_csi{};          // not a plain sequence, to be ignored
+        char prefix{};               // the private parameter byte, e.g. '?'
+        char intermediate{};         // of a CSI or escape sequence, if any
+        // the attributes set by SGR
+        FgColor sgr_fg{fg::unspecified};
+        BgColor sgr_bg{bg::unspecified};
+        style sgr_style{style::unspecified};
+        // the cursor has passed the right margin; wrap on the next character
+        bool wrap_pending{};
+        // the grapheme cluster printed last, which may still be extended
+        enum { MAX_CLUSTER = 16 };
+        char32_t cluster[MAX_CLUSTER]{};
+        uint8_t cluster_len{};
+        size_t cluster_x{}, cluster_y{};
+    };
+    AnsiState ansi;
+    // if LF in write_ansi() returns to the left margin as well, like in the
+    // new line mode (LNM) of a terminal
+    bool ansi_lf_returns{true};
+
     // increases size of grid and/or grid[y] to include (x, y) unless forbidden 
-    // by the fixation of width/height in which case an exception is thrown
-    void assure_pos(size_t x, size_t y);
+    // by the fixation of width/height in which case an exception is thrown.
+    // Returns the cell at (x, y).
+    Cell& assure_pos(size_t x, size_t y);
+
+    // Row storage. All cell access of Window goes through these two, so
+    // that derived windows may keep their rows elsewhere than in grid.
+    // find_row() returns nullptr if there is no row y (yet), access_row()
+    // creates it if necessary. Bounds are checked by assure_pos(), not here.
+    virtual const std::vector<Cell>* find_row(size_t y) const;
+    virtual std::vector<Cell>& access_row(size_t y);
+    // Returns row y if it is a SharedRow, so that copies may share it.
+    // Otherwise (or if there is no row y) nullptr.
+    virtual const SharedRow* find_shared_row(size_t y) const;
+    // Likewise for single cells. By default, these go through the rows;
+    // windows without row storage override them instead.
+    virtual const Cell* find_cell(size_t x, size_t y) const;
+    virtual Cell& access_cell(size_t x, size_t y);
+    // Overwrites the cells (x, y) to (x + n - 1, y) with cells[0..n), e.g.
+    // a row's worth of text at once. By default, this goes through the row.
+    virtual void store_cells(size_t x, size_t y, const Cell* cells, size_t n);
+    // To be called before the cells (x, y) to (x + n - 1, y) are
+    // overwritten: blanks the halves of wide graphemes which would be left
+    // behind outside of them, so that no head lacks its tail and vice versa
+    void release_wide(size_t x, size_t y, size_t n);
+    // Moves the content up by n rows: the top n rows are dropped, and n
+    // empty rows come in at the bottom. Used by write_ansi() when the
+    // cursor moves on past the bottom of a window of fixed height.
+    virtual void scroll_rows(size_t n);
+    // Copies the stored cells of the given rectangle into dest (which gets
+    // height rows, each at most width cells long). Rows lying completely
+    // inside the rectangle are shared rather than copied, if possible.
+    virtual void copy_rect(size_t x0, size_t y0, size_t width, size_t height,
+                           std::vector<SharedRow>& dest) const;
+    // Replaces the unspecified attributes of the stored cells by the
+    // defaults, see set_resolving_defaults()
+    virtual void resolve_stored_cells();
+
+    // The cell new cells are initialized with: empty, with the defaults if
+    // they are resolved on writing, otherwise unspecified
+    Cell get_blank_cell() const;
+    // the unspecified attributes of c replaced by the defaults if they are
+    // resolved on writing
+    void resolve(Cell& c) const;
+    // if this window and all of its visible children resolve the defaults
+    bool are_defaults_resolved() const;
+
+    // Returns s normalized to composed (NFC), like unicode::to_nfc(), but
+    // without allocation if s passes a quick check, and cached per thread
+    // otherwise. The reference is valid until the next call in this thread.
+    static const std::u32string& to_nfc(const std::u32string& s);
 
     // Writes the argument string starting at (cursor_x, cursor_y) into the
     // grid and moves the cursor to the position after the last printed
@@ -150,6 +317,26 @@ class Window {
                              FgColor = fg::unspecified,
                              BgColor = bg::unspecified,
                              style = style::unspecified);
+    // Likewise, for the n codepoints at s
+    size_t simple_write(const char32_t* s, size_t n,
+                        FgColor = fg::unspecified,
+                        BgColor = bg::unspecified,
+                        style = style::unspecified);
+    // Likewise, with the attributes given by runs[0..run_count), whose
+    // offsets count from s - base. This is what the others come down to:
+    // the cells are collected per row and stored by one call of
+    // store_cells() each.
+    size_t simple_write(const char32_t* s, size_t n,
+                        const TextRun* runs, size_t run_count, size_t base);
+
+    // Breaks s into lines of at most w cells, the first one starting at
+    // column x0, in a single pass. Each line is [first, second) of s. Line
+    // breaks and whitespace skipped at the end of a line are in between.
+    // If stable is given, it receives the range [first, second) of widths
+    // (including w) for which the lines would be the same.
+    void wrap_lines(const std::u32string& s, size_t x0,
+                    std::vector<std::pair<size_t, size_t>>& lines,
+                    std::pair<size_t, size_t>* stable = nullptr) const;
 
     size_t write_wordwrap(const std::u32string&,
                           FgColor = fg::unspecified,
@@ -161,6 +348,24 @@ class Window {
                           BgColor = bg::unspecified,
                           style = style::unspecified);
 
+    size_t write_wordwrap(const std::u32string&,
+                          const TextRun* runs, size_t run_count);
+
+    // write_ansi() helpers
+    void ansi_print(const char* s, size_t n); // printable ASCII only
+    void ansi_print(char32_t);
+    void ansi_erase(size_t y, size_t x0, size_t x1);
+    void ansi_sgr();
+    // Moves the cursor to the start of the next line, scrolling if needed.
+    // Called on LF and when the text wraps.
+    virtual void ansi_newline();
+    // Executes a CSI sequence, with the parameters in ansi. Sequences with
+    // private_csi set are ignored here, but may be handled by overrides.
+    virtual void ansi_csi(char final_byte);
+    // Executes an escape sequence other than CSI, e.g. ESC 7. Does nothing
+    // here.
+    virtual void ansi_esc(char final_byte);
+
    public :
     Window(size_t width = 1, size_t height = 1);
 
@@ -174,7 +379,7 @@ class Window {
     virtual void set_w(size_t);
     // trim_w() deletes only cells with empty/unspecified content and will
     // not make w less or equal to cursor.x
-    void trim_w(size_t minimum_width);
+    virtual void trim_w(size_t minimum_width);
 
     size_t get_h() const;
     // Decreasing h deletes the bottom rows to fit the new height h.
@@ -182,7 +387,7 @@ class Window {
     virtual void set_h(size_t);
     // trim_h() deletes only cells with empty/unspecified content and will
     // not make h less or equal to cursor.y
-    void trim_h(size_t minimum_height);
+    virtual void trim_h(size_t minimum_height);
 
     virtual void resize(size_t, size_t);
     void trim(size_t, size_t);
@@ -212,8 +417,10 @@ class Window {
     size_t get_tabsize() const; // default: 4
     void set_tabsize(size_t);    
 
-    uint8_t get_grapheme_length(size_t, size_t) const;
+    size_t get_grapheme_length(size_t, size_t) const;
     std::u32string get_grapheme(size_t, size_t) const;
+    // A wide grapheme (e.g. CJK, most emoji) also occupies the cell to its
+    // right, if inside the window, by marking it as Cell::WIDE_TAIL
     void set_grapheme(size_t, size_t, const std::u32string&);
     void set_char(size_t, size_t, char32_t);
 
@@ -233,6 +440,13 @@ class Window {
 
     std::vector<std::vector<Cell>> get_grid() const;
     void set_grid(const std::vector<std::vector<Cell>> &);
+    // Likewise, but the rows are shared (copy-on-write) rather than copied,
+    // which costs O(h) only
+    std::vector<SharedRow> get_shared_grid() const;
+    // The others come down to this one, which windows keeping their rows
+    // elsewhere than in grid override
+    virtual void set_grid(const std::vector<SharedRow> &);
+    // shares the rows of the argument window
     void copy_grid_from(const Window&);
 
     FgColor get_default_fg() const; // default: fg::reset
@@ -246,6 +460,15 @@ class Window {
     style get_default_style() const; // default: style::reset
     void set_default_style(style);
 
+    // If true, unspecified attributes are replaced by the defaults when
+    // cells are written (and at once for the cells stored already), rather
+    // than each time the cells are read or rendered. Changing the defaults
+    // then affects only the cells written afterwards, as with the colors
+    // set in a terminal. The renderers skip resolving the cells of a window
+    // which resolves on writing, as do all of its visible children.
+    bool is_resolving_defaults() const; // default: false
+    void set_resolving_defaults(bool = true);
+
     bool is_wordwrap() const; // default: false
     void set_wordwrap(bool = true);
     
@@ -253,7 +476,11 @@ class Window {
     // the cursor to the next free position. Returns the number of codepoints
     // (char32_t) actually written. Applies word wrap if and only if
     // width_fixed == true && and wordwrap == true, albeit not touching
-    // nor reflecting any text already present in the grid.
+    // nor reflecting any text already present in the grid. A line is
+    // filled as far as it goes and then broken at the last whitespace or
+    // wrap_after/wrap_before character in it, or at the margin if there
+    // is none. Whitespace which would overflow the line is skipped; CR and
+    // LF always break the line.
     size_t write(const std::u32string&,
                  FgColor = fg::unspecified,
                  BgColor = bg::unspecified,
@@ -265,6 +492,28 @@ class Window {
                  BgColor = bg::unspecified,
                  style = style::unspecified);
 
+    // Writes rich text: like the above, but with the attributes given per
+    // run (see TextRun), in a single pass. The run offsets must be
+    // ascending. Text in front of the first run gets the default
+    // attributes.
+    size_t write(const std::u32string&, const std::vector<TextRun>&);
+    // likewise, but the run offsets and the result count bytes (utf8)
+    size_t write(const std::string&, const std::vector<TextRun>&);
+
+    // Writes a stream of terminal output, e.g. the output of a compiler or
+    // `ls --color`, interpreting SGR escape sequences (16, 256 and 24 bit
+    // colors as well as styles) and basic cursor controls: CR, LF (which
+    // also returns to the left margin), BS, TAB and CSI A, B, C, D, G, H,
+    // f, J, K. Other escape sequences are skipped. The text wraps at the
+    // right margin of a window of fixed width. At the bottom of a window
+    // of fixed height, the content scrolls up.
+    // The stream may be split anywhere, even within a UTF-8 or escape
+    // sequence: the parser state is kept until the next call.
+    void write_ansi(const char* s, size_t n);
+    void write_ansi(const std::string&);
+    // resets the attributes set by SGR and drops any incomplete sequence
+    void reset_ansi();
+
     // when passing a single codepoint to write(), word wrap is never
     // applied. Returns 1 if success, otherwise 0.
     size_t write(char32_t ch,
@@ -281,14 +530,23 @@ class Window {
                     FgColor = fg::unspecified,
                     BgColor = bg::unspecified);
 
-    void clear_row(size_t);
-    void clear_grid();
+    virtual void clear_row(size_t);
+    virtual void clear_grid();
     void clear();
 
     Window cutout(size_t x0, size_t y0, size_t width, size_t height) const;
 
     ChildWindow* new_child(size_t = 0, size_t = 0, size_t = 0, size_t = 0,
                            border_t b = border_t::LINE);
+    // Likewise, for a class T derived from ChildWindow, e.g. PtyWindow,
+    // whose constructor takes the same arguments as ChildWindow's
+    template <class T>
+    T* new_child(size_t o_x = 0, size_t o_y = 0, size_t w_ = 0,
+                 size_t h_ = 0, border_t b = border_t::LINE) {
+        T* cwin = new T(this, o_x, o_y, w_, h_, b);
+        children.push_back(cwin);
+        return cwin;
+    }
 
     ChildWindow* get_child(size_t);
     size_t get_child_index(ChildWindow*) const;
@@ -305,6 +563,10 @@ class Window {
     Cursor get_visual_cursor() const;
 
     Window merge_children() const;
+    // Likewise, but composes the given cut-out only. The cursor is relative
+    // to the cut-out and hidden if outside.
+    Window merge_children(size_t x0, size_t y0,
+                          size_t width, size_t height) const;
 };
 
 // Represents a sub-window. Child windows may be nested.
@@ -319,12 +581,20 @@ class ChildWindow : public Window {
     FgColor border_fg;
     BgColor border_bg;
     bool visible{};
+    // virtual size: if framed, only a frame_w x frame_h cut-out of the
+    // content, starting at (scroll_x, scroll_y), is displayed
+    bool framed{};
+    size_t frame_w{}, frame_h{};
+    size_t scroll_x{}, scroll_y{};
+
+    void merge_into_grid(Window*, ptrdiff_t, ptrdiff_t, size_t, size_t) const;
 
+   protected :
+    // created by Window::new_child() only
     ChildWindow(Window* ptr, size_t off_x, size_t off_y,
                 size_t w_, size_t h_, border_t b = border_t::LINE);
     ChildWindow(const ChildWindow&) = default;
     ChildWindow(ChildWindow&&) = default;
-    void merge_into_grid(Window*, size_t, size_t, size_t, size_t) const;
 
    public :
     bool is_base_window() override {return false;}
@@ -352,6 +622,21 @@ class ChildWindow : public Window {
     void hide();
     void to_foreground();
     void to_background();
+
+    // set_frame() gives the child a display size independent of its
+    // content size (w, h). Only the cut-out starting at the scroll position
+    // is shown; the border, is_inside_parent(), move_to() and the child's
+    // own children refer to the frame. Scrolling moves no cells.
+    void set_frame(size_t width, size_t height);
+    // the frame follows w and h again (default)
+    void reset_frame();
+    bool is_framed() const;
+    size_t get_frame_w() const; // = get_w() unless framed
+    size_t get_frame_h() const; // = get_h() unless framed
+    // the scroll position is kept within the content
+    void scroll_to(size_t x, size_t y);
+    size_t get_scroll_x() const;
+    size_t get_scroll_y() const;
 };
 
 }  // namespace Term
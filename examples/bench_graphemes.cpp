@@ -0,0 +1,82 @@
+#include "../cpp-terminal/grapheme.hpp"
+#include "../cpp-terminal/utf8.hpp"
+#include "../cpp-terminal/window.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Term;
+
+// Measures the throughput of grapheme segmentation and of write_ansi() into
+// a window over text in various scripts. Doesn't need a terminal; the
+// optional argument is the size of each corpus in MB (default 4).
+
+namespace {
+
+struct Corpus {
+    const char* name;
+    u32string sample; // repeated up to the size wanted
+};
+
+const vector<Corpus> corpora = {
+    {"ascii", U"The quick brown fox jumps over the lazy dog. 0123456789 "},
+    // precomposed and decomposed (combining marks)
+    {"latin", U"Schöne Grüße aus Zürich, "
+              U"cafe\u0301 cre\u0300me bru\u0302le\u0301e "},
+    {"cjk", U"漢字かなカナ混じり文。ＡＢＣ、中文 "},
+    // syllables and conjoining jamo
+    {"hangul", U"한국어 텍스트 \u1112\u1161\u11AB\u1100\u116E\u11A8 "},
+    {"devanagari", U"नमस्ते हिन्दी क्षत्रिय "},
+    // ZWJ sequences, skin tones, flags, variation selectors
+    {"emoji", U"\U0001F468\u200D\U0001F469\u200D\U0001F467 "
+              U"\U0001F44D\U0001F3FD \U0001F1E9\U0001F1EA\U0001F1EF\U0001F1F5 "
+              U"\u2764\uFE0F \U0001F600 "},
+    {"mixed", U"Hello 世界! cafe\u0301 नमस्ते 한국 "
+              U"\U0001F44B\U0001F3FB \U0001F1FA\U0001F1F8 "},
+};
+
+double seconds_since(chrono::steady_clock::time_point t0) {
+    return chrono::duration<double>(chrono::steady_clock::now() - t0)
+        .count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t mb = (argc > 1 ? strtoul(argv[1], nullptr, 10) : 4);
+    if (!mb) mb = 1;
+    printf("utf8 kernels: %s\n", utf8_kernels());
+    printf("%-12s %12s %12s %12s\n", "corpus", "segment MB/s",
+           "Mcluster/s", "write MB/s");
+    for (const Corpus& corpus : corpora) {
+        string utf8 = utf8_encode(corpus.sample);
+        string text;
+        while (text.size() < mb << 20) text += utf8;
+        u32string codepoints = utf8_decode(text);
+
+        auto t0 = chrono::steady_clock::now();
+        size_t clusters = 0;
+        for (size_t i = 0; i < codepoints.size(); ++clusters) {
+            i += grapheme_length(codepoints.data() + i,
+                                 codepoints.size() - i);
+        }
+        double segment = seconds_since(t0);
+
+        // the text wraps at the right margin and scrolls at the bottom,
+        // like the output of a program running in a pane
+        Window win(120, 40);
+        t0 = chrono::steady_clock::now();
+        win.write_ansi(text);
+        double write = seconds_since(t0);
+
+        double size = double(text.size()) / (1 << 20);
+        printf("%-12s %12.1f %12.2f %12.1f\n", corpus.name,
+               size / segment, clusters / segment / 1e6, size / write);
+    }
+    return 0;
+}
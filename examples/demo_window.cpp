@@ -1,5 +1,6 @@
 #include "../cpp-terminal/base.hpp"
 #include "../cpp-terminal/window.hpp"
+#include "../cpp-terminal/text_view.hpp"
 #include "../cpp-terminal/input.hpp"
 
 #include <iostream>
@@ -15,8 +16,8 @@ int main()
 {
     try {
         Terminal term(CLEAR_SCREEN | RAW_INPUT | DISABLE_CTRL_C);
-        Window win(term.get_w(), term.get_h());
-        win.set_wordwrap(true);
+        // keeps its text, which reflows when the terminal is resized
+        TextViewWindow win(term.get_w(), term.get_h());
         u32string info = // will be filled into win in the main loop
             U"This demo illustrates several features of the \"Window\" "
             "class. Type some text into the green window, press F2 or "
@@ -93,15 +94,13 @@ int main()
             cwin->set_border(border_t::DOUBLE_LINE);
             win.hand_over_visual_cursor(cwin);
             if (term.update_size()) {
-                win.clear_grid();
                 win.resize(term.get_w(), term.get_h());
                 refill_win = true;
             }
             if (refill_win) {
-                size_t written{};
-                do {
-                    written = win.write(info);
-                } while(written == info.size());
+                while (win.get_line_count() < win.get_h()) {
+                    win.append_paragraph(info);
+                }
                 refill_win = false;
                 update = true;
             }
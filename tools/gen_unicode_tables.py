@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""Generates cpp-terminal/unicode_tables.cpp from the Unicode Character
+Database. Usage:
+
+    gen_unicode_tables.py UCD_DIR > cpp-terminal/unicode_tables.cpp
+
+UCD_DIR must contain GraphemeBreakProperty.txt (from auxiliary/),
+emoji-data.txt (from emoji/) and EastAsianWidth.txt, e.g. as unpacked from
+https://www.unicode.org/Public/UCD/latest/ucd/UCD.zip
+
+For every codepoint, one byte of properties is stored (see grapheme.hpp):
+bits 0-3 the Grapheme_Cluster_Break value, bit 4 Extended_Pictographic and
+bits 5-6 the display width (0, 1 or 2 cells). The bytes are split into
+blocks of 1 << SHIFT codepoints; identical blocks are stored only once.
+"""
+
+import os
+import re
+import sys
+
+SHIFT = 7
+MAX_CP = 0x10FFFF
+
+# must match Term::gcb in grapheme.hpp
+GCB = ["Other", "CR", "LF", "Control", "Extend", "ZWJ", "Regional_Indicator",
+       "Prepend", "SpacingMark", "L", "V", "T", "LV", "LVT"]
+EXT_PICT = 0x10
+WIDTH_SHIFT = 5
+
+# unassigned codepoints in these ranges default to East_Asian_Width=W
+DEFAULT_WIDE = [(0x3400, 0x4DBF), (0x4E00, 0x9FFF), (0xF900, 0xFAFF),
+                (0x20000, 0x2FFFD), (0x30000, 0x3FFFD)]
+
+LINE = re.compile(r"^([0-9A-Fa-f]+)(?:\.\.([0-9A-Fa-f]+))?\s*;\s*(\w+)")
+
+
+def parse(path):
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            m = LINE.match(line)
+            if m:
+                lo = int(m.group(1), 16)
+                hi = int(m.group(2), 16) if m.group(2) else lo
+                yield lo, hi, m.group(3)
+
+
+def main():
+    ucd = sys.argv[1] if len(sys.argv) > 1 else "."
+    gcb = [0] * (MAX_CP + 1)
+    for lo, hi, value in parse(os.path.join(ucd,
+                                            "GraphemeBreakProperty.txt")):
+        gcb[lo:hi + 1] = [GCB.index(value)] * (hi - lo + 1)
+    pict = [False] * (MAX_CP + 1)
+    for lo, hi, value in parse(os.path.join(ucd, "emoji-data.txt")):
+        if value == "Extended_Pictographic":
+            pict[lo:hi + 1] = [True] * (hi - lo + 1)
+    wide = [False] * (MAX_CP + 1)
+    for lo, hi in DEFAULT_WIDE:
+        wide[lo:hi + 1] = [True] * (hi - lo + 1)
+    for lo, hi, value in parse(os.path.join(ucd, "EastAsianWidth.txt")):
+        wide[lo:hi + 1] = [value in ("W", "F")] * (hi - lo + 1)
+
+    zero_width = {GCB.index(v) for v in
+                  ("CR", "LF", "Control", "Extend", "ZWJ", "V", "T")}
+    props = bytearray(MAX_CP + 1)
+    for cp in range(MAX_CP + 1):
+        if gcb[cp] in zero_width:
+            width = 0
+        elif wide[cp]:
+            width = 2
+        else:
+            width = 1
+        props[cp] = (gcb[cp] | (EXT_PICT if pict[cp] else 0) |
+                     (width << WIDTH_SHIFT))
+
+    block_size = 1 << SHIFT
+    blocks = {}
+    index = []
+    data = bytearray()
+    for start in range(0, MAX_CP + 1, block_size):
+        block = bytes(props[start:start + block_size])
+        if block not in blocks:
+            blocks[block] = len(blocks)
+            data += block
+        index.append(blocks[block])
+
+    # the index holds bytes
+    if len(blocks) > 256:
+        sys.exit("too many distinct blocks, increase SHIFT")
+
+    out = sys.stdout
+    out.write("// Generated by tools/gen_unicode_tables.py. Do not edit.\n")
+    out.write('#include "grapheme.hpp"\n\n')
+    out.write("const uint8_t Term::Private::char_props_index[] = {\n")
+    write_array(out, index, "0x{:02x}")
+    out.write("};\n\n")
+    out.write("const uint8_t Term::Private::char_props_data[] = {\n")
+    write_array(out, data, "0x{:02x}")
+    out.write("};\n")
+    sys.stderr.write("{} blocks, {} bytes\n".format(
+        len(blocks), len(index) + len(data)))
+
+
+def write_array(out, values, fmt, per_line=12):
+    for i in range(0, len(values), per_line):
+        chunk = values[i:i + per_line]
+        out.write("    " + ", ".join(fmt.format(v) for v in chunk) + ",\n")
+
+
+if __name__ == "__main__":
+    main()